@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# Hogwild contention benchmark: trains with increasing numbers of threads,
+# with and without per-thread hot-row caching, and reports the throughput of
+# each run.  Usage: ./contention-bench.sh [text file] [hot rows] [thread counts]
+
+DATA_DIR=../data
+BIN_DIR=../bin
+SRC_DIR=../src
+
+TEXT_DATA=${1:-$DATA_DIR/text8}
+HOT_ROWS=${2:-1000}
+THREADS=${3:-"1 2 4 8 12 16 20"}
+VOCAB_CACHE=$DATA_DIR/contention-bench.vocab
+OPTIONS="-train $TEXT_DATA -vocab-cache $VOCAB_CACHE -cbow 0 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -iter 1 -debug 1"
+
+if [ ! -e $TEXT_DATA ]; then
+	sh ./create-text8-data.sh
+fi
+# Build the vocabulary cache once, so that only training is timed
+$BIN_DIR/word2vec $OPTIONS -threads 1 > /dev/null
+
+printf "threads\tshared\thot-rows %s\n" $HOT_ROWS
+for T in $THREADS; do
+  SHARED=`$BIN_DIR/word2vec $OPTIONS -threads $T -output /dev/null | grep "^Trained" | sed 's/.*, \([0-9]*\) words\/sec/\1/'`
+  HOT=`$BIN_DIR/word2vec $OPTIONS -threads $T -hot-rows $HOT_ROWS -output /dev/null | grep "^Trained" | sed 's/.*, \([0-9]*\) words\/sec/\1/'`
+  printf "%s\t%s\t%s\n" $T $SHARED $HOT
+done
@@ -13,12 +13,11 @@ exit 1
 #
 ###############################################################################################
 
-# This function will convert text to lowercase and remove special characters
+# This function will convert text to lowercase and remove special characters,
+# with the normalize tool built from ../src
+NORMALIZE=`pwd`/../bin/normalize
 normalize_text() {
-  awk '{print tolower($0);}' | sed -e "s/’/'/g" -e "s/′/'/g" -e "s/''/ /g" -e "s/'/ ' /g" -e "s/“/\"/g" -e "s/”/\"/g" \
-  -e 's/"/ " /g' -e 's/\./ \. /g' -e 's/<br \/>/ /g' -e 's/, / , /g' -e 's/(/ ( /g' -e 's/)/ ) /g' -e 's/\!/ \! /g' \
-  -e 's/\?/ \? /g' -e 's/\;/ /g' -e 's/\:/ /g' -e 's/-/ - /g' -e 's/=/ /g' -e 's/=/ /g' -e 's/*/ /g' -e 's/|/ /g' \
-  -e 's/«/ /g' | tr 0-9 " "
+  $NORMALIZE -debug 0
 }
 
 mkdir word2vec
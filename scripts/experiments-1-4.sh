@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# All four experimental conditions, trained together from a single pass over
+# the data (see -models).  Experiment 2 pins gender, latitude and mass
+# (dimensions 0-2); experiment 4 adds hasWheels and isDangerous (3 and 4).
+
+DATA_DIR=../data
+BIN_DIR=../bin
+SRC_DIR=../src
+
+TEXT_DATA=$DATA_DIR/text8
+MODELS=$DATA_DIR/experiments-1-4.models
+
+if [ ! -e $TEXT_DATA ]; then
+	sh ./create-text8-data.sh
+fi
+mkdir -p $DATA_DIR/experiment1 $DATA_DIR/experiment2 $DATA_DIR/experiment3 $DATA_DIR/experiment4
+cat > $MODELS <<END
+$DATA_DIR/experiment1/text8-vector.bin
+$DATA_DIR/experiment2/text8-vector.bin -pin 1 -pin-dims 0-2
+$DATA_DIR/experiment3/text8-vector.bin -pin 1 -pin-dims 0-2 -pin-repeats 1000
+$DATA_DIR/experiment4/text8-vector.bin -pin 1 -pin-dims 0-4
+END
+echo -----------------------------------------------------------------------------------------------------
+echo -- Training vectors...
+time $BIN_DIR/word2vec -train $TEXT_DATA -models $MODELS -cbow 0 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -threads 20 -binary 1 -iter 15
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Distributed training on localhost: starts SERVERS parameter servers, then
+# trains with 1, 2 and 4 worker processes and reports the overall throughput
+# of each run.  Usage: ./ps-scaling.sh [text file] [servers]
+
+DATA_DIR=../data
+BIN_DIR=../bin
+SRC_DIR=../src
+
+TEXT_DATA=${1:-$DATA_DIR/text8}
+SERVERS=${2:-2}
+VOCAB_CACHE=$DATA_DIR/ps-scaling.vocab
+OPTIONS="-train $TEXT_DATA -vocab-cache $VOCAB_CACHE -cbow 0 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -threads 4 -iter 1 -debug 1"
+
+if [ ! -e $TEXT_DATA ]; then
+	sh ./create-text8-data.sh
+fi
+# Build the vocabulary cache once, so that every process starts quickly
+$BIN_DIR/word2vec $OPTIONS > /dev/null
+
+for WORKERS in 1 2 4; do
+  ADDRS=""
+  for ((s = 0; s < SERVERS; s++)); do
+    $BIN_DIR/word2vec $OPTIONS -ps-serve 127.0.0.1:$((7700 + s)) -ps-shard $s -ps-shards $SERVERS -ps-workers $WORKERS > /dev/null &
+    ADDRS="$ADDRS${ADDRS:+,}127.0.0.1:$((7700 + s))"
+  done
+  for ((w = 1; w < WORKERS; w++)); do
+    $BIN_DIR/word2vec $OPTIONS -ps-servers $ADDRS -ps-worker $w -ps-workers $WORKERS > /dev/null &
+  done
+  $BIN_DIR/word2vec $OPTIONS -ps-servers $ADDRS -ps-worker 0 -ps-workers $WORKERS | grep "^All"
+  wait
+done
@@ -19,6 +19,8 @@
 #include <stdlib.h> // mac os x
 // #include <malloc.h>
 
+#include "vectors.h"
+
 const long long max_size = 2000;         // max length of strings
 const long long N = 40;                  // number of closest words that will be shown
 const long long max_w = 50;              // max length of vocabulary entries
@@ -30,10 +32,12 @@ int main(int argc, char **argv) {
   char file_name[max_size], st[100][max_size];
   float dist, len, bestd[N], vec[max_size];
   long long words, size, a, b, c, d, cn, bi[100];
-  float *M;
+  float *M = NULL, *scale = NULL;
+  signed char *Q = NULL;
   char *vocab;
+  int r;
   if (argc < 2) {
-    printf("Usage: ./distance <FILE>\nwhere FILE contains word projections in the BINARY FORMAT\n");
+    printf("Usage: ./distance <FILE>\nwhere FILE contains word projections in the BINARY FORMAT (word2vec -binary 1 or 2) or text format\n");
     return 0;
   }
   strcpy(file_name, argv[1]);
@@ -42,29 +46,10 @@ int main(int argc, char **argv) {
     printf("Input file not found\n");
     return -1;
   }
-  fscanf(f, "%lld", &words);
-  fscanf(f, "%lld", &size);
-  vocab = (char *)malloc((long long)words * max_w * sizeof(char));
   for (a = 0; a < N; a++) bestw[a] = (char *)malloc(max_size * sizeof(char));
-  M = (float *)malloc((long long)words * (long long)size * sizeof(float));
-  if (M == NULL) {
-    printf("Cannot allocate memory: %lld MB    %lld  %lld\n", (long long)words * size * sizeof(float) / 1048576, words, size);
-    return -1;
-  }
-  for (b = 0; b < words; b++) {
-    a = 0;
-    while (1) {
-      vocab[b * max_w + a] = fgetc(f);
-      if (feof(f) || (vocab[b * max_w + a] == ' ')) break;
-      if ((a < max_w) && (vocab[b * max_w + a] != '\n')) a++;
-    }
-    vocab[b * max_w + a] = 0;
-    for (a = 0; a < size; a++) fread(&M[a + b * size], sizeof(float), 1, f);
-    len = 0;
-    for (a = 0; a < size; a++) len += M[a + b * size] * M[a + b * size];
-    len = sqrt(len);
-    for (a = 0; a < size; a++) M[a + b * size] /= len;
-  }
+  // int8 models are searched as they are, in a quarter of the memory
+  r = ReadQuantizedVectors(f, max_w, &words, &size, &vocab, &Q, &scale);
+  if ((r < 0) || ((r == 0) && (ReadVectors(f, 0, max_w, &words, &size, &vocab, &M, 1) < 0))) return -1;
   fclose(f);
   while (1) {
     for (a = 0; a < N; a++) bestd[a] = 0;
@@ -111,7 +96,7 @@ int main(int argc, char **argv) {
     for (a = 0; a < size; a++) vec[a] = 0;
     for (b = 0; b < cn; b++) {
       if (bi[b] == -1) continue;
-      for (a = 0; a < size; a++) vec[a] += M[a + bi[b] * size];
+      for (a = 0; a < size; a++) vec[a] += RowValue(M, Q, scale, size, bi[b], a);
     }
     len = 0;
     for (a = 0; a < size; a++) len += vec[a] * vec[a];
@@ -124,7 +109,10 @@ int main(int argc, char **argv) {
       for (b = 0; b < cn; b++) if (bi[b] == c) a = 1;
       if (a == 1) continue;
       dist = 0;
-      for (a = 0; a < size; a++) dist += vec[a] * M[a + c * size];
+      if (Q != NULL) {
+        for (a = 0; a < size; a++) dist += vec[a] * Q[a + c * size];
+        dist *= scale[c];
+      } else for (a = 0; a < size; a++) dist += vec[a] * M[a + c * size];
       for (a = 0; a < N; a++) {
         if (dist > bestd[a]) {
           for (d = N - 1; d > a; d--) {
@@ -19,6 +19,8 @@
 #include <stdlib.h> // mac os x
 // #include <malloc.h>
 
+#include "vectors.h"
+
 int vector_len;			// actual length (number of floats) of our vectors
 
 // Very simple class to represent an embedded word vector.
@@ -47,11 +49,6 @@ char *vocab;							// actual vocabulary entries (text)
 Vector* vectors;
 
 bool Allocate(long numWords) {
-	vocab = (char *)malloc((long)numWords * max_w * sizeof(char));
-	if (!vocab) {
-		printf("Vocab allocation failed\n");
-		return false;
-	}
 	vectors = (Vector*)malloc(numWords * sizeof(Vector));
 	if (!vectors) {
 		printf("Vector allocation failed\n");
@@ -750,7 +747,7 @@ void OutputIsDangerousWords(const char *filename) {
 int main(int argc, char **argv) {
 	// validate arguments
 	if (argc < 2) {
-		printf("Usage: ./strout-baseline <FILE>\nwhere FILE contains word projections in the BINARY FORMAT\n");
+		printf("Usage: ./strout-baseline <FILE>\nwhere FILE contains word projections in the BINARY FORMAT (word2vec -binary 1 or 2) or text format\n");
 		return 0;
 	}
 
@@ -761,27 +758,18 @@ int main(int argc, char **argv) {
 		return -1;
 	}
 	
-	fscanf(f, "%ld", &num_words);
-	fscanf(f, "%d", &vector_len);
+	// read the vocabulary and the vectors (in any of word2vec's formats),
+	// then point each Vector at its row
+	long long words, size;
+	float *M;
+	if (ReadVectors(f, 0, max_w, &words, &size, &vocab, &M, 0) < 0) return -1;
+	num_words = words;
+	vector_len = size;
 
 	if (!Allocate(num_words)) return -1;
 
 	for (long idx = 0; idx < num_words; idx++) {
-		// read the vocab word (text), up to the first space or \n
-		char *wordc = WordAtIndex(idx);
-		while (true) {
-			char c = fgetc(f);
-			if (feof(f) or c == ' ') break;
-			if (c != '\n') *wordc++ = c;
-		}
-		*wordc = 0;
-		// then, read the vector entries
-		Vector v;
-		v.d = (float*)malloc(vector_len * sizeof(float));
-		for (int i=0; i<vector_len; i++) {
-			fread(&v.d[i], sizeof(float), 1, f);
-		}
-		vectors[idx] = v;
+		vectors[idx].d = M + idx * vector_len;
 	}
 	fclose(f);
 
@@ -0,0 +1,39 @@
+//  The aligned model format (-binary 2), written by word2vec and read by
+//  vectors.h.  Unlike the text and binary formats, which have to be parsed
+//  word by word, the file can be mapped into memory and used as it is.  It is
+//  a header, then sections that each start on a MODEL_FILE_ALIGN boundary:
+//    index    vocab_size + 1 long longs; word i is at strings + index[i], and
+//             index[vocab_size] is the size of the string table
+//    strings  the words, NUL-terminated, in frequency order
+//    matrix   vocab_size rows of dim values of type dtype: float32, float16
+//             or int8; an int8 row stands for its values times its scale
+//    norms    vocab_size floats, the Euclidean norm of each row as stored
+//             (optional; norms_offset is 0 if they were not written)
+//    scales   vocab_size floats, the scale of each int8 row (int8 only)
+
+#define MODEL_FILE_MAGIC "W2VMODEL"
+#define MODEL_FILE_VERSION 1
+#define MODEL_FILE_ALIGN 64
+#define MODEL_FLOAT32 0
+#define MODEL_FLOAT16 1
+#define MODEL_INT8 2
+
+struct model_file_header {
+  char magic[8];
+  int version, dtype;
+  long long vocab_size, dim;
+  long long index_offset, strings_offset, matrix_offset, norms_offset, total_size;
+  long long scales_offset;                // within the padding of older headers, so 0 there
+};
+
+static inline float HalfToFloat(unsigned short h) {
+  unsigned int f, e = (h >> 10) & 0x1f;
+  float x;
+  if (e == 0) {
+    x = (h & 0x3ff) * (1.0f / 16777216);
+    return (h & 0x8000) ? -x : x;
+  }
+  f = ((h & 0x8000) << 16) | ((h & 0x3ff) << 13) | ((e == 31) ? 0x7f800000 : (e + 112) << 23);
+  memcpy(&x, &f, sizeof(x));
+  return x;
+}
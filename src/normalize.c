@@ -0,0 +1,312 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Normalizes text for word2phrase and word2vec, in place of the awk / sed /
+// tr pipelines of the scripts: it lowercases the text, unifies apostrophes
+// and quotes, puts spaces around punctuation and removes digits, reading the
+// input in chunks of whole lines that are normalized by several threads and
+// written in order.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_STRING 4096
+#define CHUNK_BYTES (1 << 22)          // Size of the pieces of text given to each thread
+
+char input_file[MAX_STRING], output_file[MAX_STRING];
+int debug_mode = 2, num_threads = 12, letters_only = 0;
+
+// Returns the length of the apostrophe at p (', ’ or ′), or 0 if there is none
+static inline int Apostrophe(const unsigned char *p, const unsigned char *end) {
+  if (p >= end) return 0;
+  if (*p == '\'') return 1;
+  if ((end - p >= 3) && (p[0] == 0xE2) && (p[1] == 0x80) && ((p[2] == 0x99) || (p[2] == 0xB2))) return 3;
+  return 0;
+}
+
+// Returns the length of the double quote at p (", “ or ”), or 0 if there is none
+static inline int Quote(const unsigned char *p, const unsigned char *end) {
+  if (p >= end) return 0;
+  if (*p == '"') return 1;
+  if ((end - p >= 3) && (p[0] == 0xE2) && (p[1] == 0x80) && ((p[2] == 0x9C) || (p[2] == 0x9D))) return 3;
+  return 0;
+}
+
+// Returns whether p starts with <br />, in any case
+static inline int LineBreakTag(const unsigned char *p, const unsigned char *end) {
+  const char *tag = "<br />";
+  int a;
+  if (end - p < 6) return 0;
+  for (a = 0; a < 6; a++) if (((p[a] >= 'A') && (p[a] <= 'Z') ? p[a] + 32 : p[a]) != tag[a]) return 0;
+  return 1;
+}
+
+// Returns the length of the UTF-8 sequence at p, or 0 if it is not valid
+static inline int SequenceLength(const unsigned char *p, const unsigned char *end) {
+  int a, n = (*p < 0x80) ? 1 : (*p < 0xC2) ? 0 : (*p < 0xE0) ? 2 : (*p < 0xF0) ? 3 : (*p < 0xF5) ? 4 : 0;
+  if (end - p < n) return 0;
+  for (a = 1; a < n; a++) if ((p[a] & 0xC0) != 0x80) return 0;
+  return n;
+}
+
+// Lowercases a code point of two UTF-8 bytes (Latin-1, Latin Extended-A,
+// Greek and Cyrillic capitals), keeping it two bytes long
+static inline unsigned int LowerCodePoint(unsigned int c) {
+  if ((c >= 0xC0) && (c <= 0xDE) && (c != 0xD7)) return c + 0x20;
+  if ((c >= 0x100) && (c <= 0x137) && !(c & 1) && (c != 0x130)) return c + 1;
+  if ((c >= 0x139) && (c <= 0x148) && (c & 1)) return c + 1;
+  if ((c >= 0x14A) && (c <= 0x177) && !(c & 1)) return c + 1;
+  if ((c == 0x179) || (c == 0x17B) || (c == 0x17D)) return c + 1;
+  if (c == 0x178) return 0xFF;
+  if ((c >= 0x391) && (c <= 0x3AB) && (c != 0x3A2)) return c + 0x20;
+  if ((c >= 0x410) && (c <= 0x42F)) return c + 0x20;
+  if ((c >= 0x400) && (c <= 0x40F)) return c + 0x50;
+  return c;
+}
+
+// Normalizes the n bytes of whole lines at 'in' into 'out', which must have
+// room for 3 * n bytes, and returns the length of the result.  By default
+// the rules are those of normalize_text() in demo-train-big-model-v1.sh:
+// ’ and ′ become ', two apostrophes in a row become a space, apostrophes,
+// quotes (“ and ” becoming "), periods, brackets, ! ? - and commas followed
+// by a space are set apart by spaces, <br /> ; : = * | « and digits become
+// spaces, and the text is lowercased.  With -letters 1, as in
+// create-lowercase-phrases-data.sh, only letters, apostrophes and underscores
+// are kept, everything else becoming a space.
+long long NormalizeText(const unsigned char *in, long long n, char *out) {
+  const unsigned char *p = in, *end = in + n;
+  char *o = out;
+  unsigned int c;
+  int k, k2;
+  while (p < end) {
+    c = *p;
+    if ((k = Apostrophe(p, end)) > 0) {
+      if ((k2 = Apostrophe(p + k, end)) > 0) {
+        *o++ = ' ';
+        p += k + k2;
+      } else {
+        if (!letters_only) *o++ = ' ';
+        *o++ = '\'';
+        if (!letters_only) *o++ = ' ';
+        p += k;
+      }
+      continue;
+    }
+    if (c >= 0x80) {
+      k = SequenceLength(p, end);
+      if (letters_only) {
+        *o++ = ' ';
+        p += (k > 0) ? k : 1;
+      } else if ((k2 = Quote(p, end)) > 0) {
+        memcpy(o, " \" ", 3);
+        o += 3;
+        p += k2;
+      } else if ((k == 2) && (p[0] == 0xC2) && (p[1] == 0xAB)) {
+        *o++ = ' ';
+        p += 2;
+      } else if (k == 2) {
+        c = LowerCodePoint(((p[0] & 0x1F) << 6) | (p[1] & 0x3F));
+        *o++ = 0xC0 | (c >> 6);
+        *o++ = 0x80 | (c & 0x3F);
+        p += 2;
+      } else {
+        // Longer sequences, and bytes that are not valid UTF-8, are kept as is
+        if (k == 0) k = 1;
+        memcpy(o, p, k);
+        o += k;
+        p += k;
+      }
+      continue;
+    }
+    p++;
+    if ((c >= 'A') && (c <= 'Z')) c += 32;
+    if (letters_only) {
+      *o++ = (((c >= 'a') && (c <= 'z')) || (c == '_') || (c == ' ') || (c == '\n')) ? c : ' ';
+      continue;
+    }
+    switch (c) {
+      case '"': case '.': case '(': case ')': case '!': case '?': case '-':
+        *o++ = ' ';
+        *o++ = c;
+        *o++ = ' ';
+        break;
+      case ',':
+        // Only a comma followed by a space, once the rules before it have
+        // been applied, is set apart; that space follows
+        if ((p < end) && ((*p == ' ') || (*p == '.') || Apostrophe(p, end) || Quote(p, end) || LineBreakTag(p, end))) *o++ = ' ';
+        *o++ = ',';
+        break;
+      case '<':
+        if (LineBreakTag(p - 1, end)) {
+          *o++ = ' ';
+          p += 5;
+        } else *o++ = c;
+        break;
+      case ';': case ':': case '=': case '*': case '|':
+      case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        *o++ = ' ';
+        break;
+      default:
+        *o++ = c;
+    }
+  }
+  return o - out;
+}
+
+// A chunk of the input and its normalized text
+struct chunk {
+  unsigned char *in;
+  char *out;
+  long long size, capacity, out_size, out_capacity;
+};
+
+FILE *fin, *fo;
+unsigned char *carry = NULL;           // start of a line read past the end of the last chunk
+long long carry_size = 0, bytes_read = 0;
+
+// Fills 'c' with the next chunk of whole lines of the input, giving the last
+// line a newline if it has none.  Returns 0 at the end.
+int NextChunk(struct chunk *c) {
+  long long a, n;
+  if (c->capacity < CHUNK_BYTES + carry_size) {
+    c->capacity = CHUNK_BYTES + carry_size;
+    c->in = (unsigned char *)realloc(c->in, c->capacity);
+  }
+  memcpy(c->in, carry, carry_size);
+  c->size = carry_size;
+  carry_size = 0;
+  while (1) {
+    if (c->capacity < c->size + CHUNK_BYTES) {
+      c->capacity = c->size + CHUNK_BYTES;
+      c->in = (unsigned char *)realloc(c->in, c->capacity);
+    }
+    n = fread(c->in + c->size, 1, CHUNK_BYTES, fin);
+    if (n == 0) {
+      if ((c->size > 0) && (c->in[c->size - 1] != '\n')) c->in[c->size++] = '\n';
+      break;
+    }
+    bytes_read += n;
+    c->size += n;
+    // Keep the last partial line for the next chunk
+    for (a = c->size; (a > c->size - n) && (c->in[a - 1] != '\n'); a--);
+    if (a > c->size - n) {
+      carry = (unsigned char *)realloc(carry, c->size - a + 1);
+      carry_size = c->size - a;
+      memcpy(carry, c->in + a, carry_size);
+      c->size = a;
+      break;
+    }
+  }
+  return c->size > 0;
+}
+
+void *NormalizeThread(void *arg) {
+  struct chunk *c = (struct chunk *)arg;
+  if (c->out_capacity < 3 * c->size) {
+    c->out_capacity = 3 * c->size;
+    c->out = (char *)realloc(c->out, c->out_capacity);
+  }
+  c->out_size = NormalizeText(c->in, c->size, c->out);
+  return NULL;
+}
+
+// Normalizes the input num_threads chunks at a time
+void Normalize() {
+  int a, n;
+  struct chunk *chunks = (struct chunk *)calloc(num_threads, sizeof(struct chunk));
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  while (1) {
+    for (n = 0; n < num_threads; n++) if (!NextChunk(&chunks[n])) break;
+    if (n == 0) break;
+    for (a = 0; a < n; a++) pthread_create(&pt[a], NULL, NormalizeThread, &chunks[a]);
+    for (a = 0; a < n; a++) pthread_join(pt[a], NULL);
+    for (a = 0; a < n; a++) fwrite(chunks[a].out, 1, chunks[a].out_size, fo);
+    if (debug_mode > 1) {
+      fprintf(stderr, "Bytes normalized: %lldM%c", bytes_read >> 20, 13);
+      fflush(stderr);
+    }
+    if (n < num_threads) break;
+  }
+  if (debug_mode > 1) fprintf(stderr, "\n");
+  for (a = 0; a < num_threads; a++) {
+    free(chunks[a].in);
+    free(chunks[a].out);
+  }
+  free(chunks);
+  free(pt);
+  free(carry);
+}
+
+int ArgPos(char *str, int argc, char **argv) {
+  int a;
+  for (a = 1; a < argc; a++) if (!strcmp(str, argv[a])) {
+    if (a == argc - 1) {
+      printf("Argument missing for %s\n", str);
+      exit(1);
+    }
+    return a;
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  int i;
+  if ((argc == 1) && isatty(0)) {
+    printf("TEXT NORMALIZATION tool\n\n");
+    printf("Options:\n");
+    printf("\t-input <file>\n");
+    printf("\t\tNormalize the text of <file>; default is the standard input\n");
+    printf("\t-output <file>\n");
+    printf("\t\tWrite the normalized text to <file>; default is the standard output\n");
+    printf("\t-letters <int>\n");
+    printf("\t\tKeep only letters, apostrophes and underscores (1), or keep punctuation and set it apart with\n");
+    printf("\t\tspaces (0, the default); the text is lowercased and digits are removed either way\n");
+    printf("\t-threads <int>\n");
+    printf("\t\tUse <int> threads (default 12)\n");
+    printf("\t-debug <int>\n");
+    printf("\t\tSet the debug mode (default = 2 = progress on the standard error)\n");
+    printf("\nExamples:\n");
+    printf("./normalize -input news.txt -output news-norm.txt\n");
+    printf("bzip2 -c -d text.bz2 | ./normalize -letters 1 > text-norm.txt\n\n");
+    return 0;
+  }
+  input_file[0] = 0;
+  output_file[0] = 0;
+  if ((i = ArgPos((char *)"-input", argc, argv)) > 0) strcpy(input_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-output", argc, argv)) > 0) strcpy(output_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-letters", argc, argv)) > 0) letters_only = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_threads = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
+  if (num_threads < 1) num_threads = 1;
+  fin = input_file[0] ? fopen(input_file, "rb") : stdin;
+  if (fin == NULL) {
+    fprintf(stderr, "ERROR: input file not found: %s\n", input_file);
+    return 1;
+  }
+  fo = output_file[0] ? fopen(output_file, "wb") : stdout;
+  if (fo == NULL) {
+    fprintf(stderr, "ERROR: can not write %s\n", output_file);
+    return 1;
+  }
+  Normalize();
+  if (fin != stdin) fclose(fin);
+  if (fclose(fo) != 0) {
+    fprintf(stderr, "ERROR: can not write %s\n", output_file[0] ? output_file : "the standard output");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,109 @@
+//  Training input, shared by word2vec and word2phrase.  -train names a single
+//  file, a directory (every regular file in it, in name order), a glob
+//  pattern, or "@<manifest>", a file listing one training file per line.  The
+//  files are read as one stream, one after the other.
+
+#ifndef _MSC_VER
+#include <sys/stat.h>
+#include <dirent.h>
+#include <glob.h>
+#endif
+
+#define MAX_PATH_STRING 4096
+
+char **train_files;
+long long *train_file_sizes;
+int train_file_count = 0, train_file_max = 0;
+
+void AddTrainFile(const char *name) {
+  FILE *fin = fopen(name, "rb");
+  if (fin == NULL) {
+    printf("ERROR: training data file not found: %s\n", name);
+    exit(1);
+  }
+  if (train_file_count >= train_file_max) {
+    train_file_max = train_file_max * 2 + 16;
+    train_files = (char **)realloc(train_files, train_file_max * sizeof(char *));
+    train_file_sizes = (long long *)realloc(train_file_sizes, train_file_max * sizeof(long long));
+  }
+  fseek(fin, 0, SEEK_END);
+  train_file_sizes[train_file_count] = ftell(fin);
+  fclose(fin);
+  train_files[train_file_count] = strdup(name);
+  train_file_count++;
+}
+
+int CompareFileNames(const void *a, const void *b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Expands the -train argument into the list of training files
+void ListTrainFiles(const char *train) {
+  long long a;
+  if (train[0] == '@') {
+    char line[MAX_PATH_STRING];
+    FILE *fin = fopen(train + 1, "rb");
+    if (fin == NULL) {
+      printf("ERROR: training file list not found: %s\n", train + 1);
+      exit(1);
+    }
+    while (fgets(line, MAX_PATH_STRING, fin) != NULL) {
+      line[strcspn(line, "\r\n")] = 0;
+      if (line[0] != 0) AddTrainFile(line);
+    }
+    fclose(fin);
+  } else {
+#ifdef _MSC_VER
+    AddTrainFile(train);
+#else
+    struct stat st;
+    glob_t g;
+    if ((stat(train, &st) == 0) && S_ISDIR(st.st_mode)) {
+      char path[MAX_PATH_STRING + 256], **names = NULL;
+      int name_count = 0;
+      struct dirent *entry;
+      DIR *dir = opendir(train);
+      while ((dir != NULL) && ((entry = readdir(dir)) != NULL)) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", train, entry->d_name);
+        if ((stat(path, &st) != 0) || !S_ISREG(st.st_mode)) continue;
+        names = (char **)realloc(names, (name_count + 1) * sizeof(char *));
+        names[name_count++] = strdup(path);
+      }
+      if (dir != NULL) closedir(dir);
+      qsort(names, name_count, sizeof(char *), CompareFileNames);
+      for (a = 0; a < name_count; a++) {
+        AddTrainFile(names[a]);
+        free(names[a]);
+      }
+      free(names);
+    } else if (strpbrk(train, "*?[") != NULL) {
+      if (glob(train, 0, NULL, &g) == 0) {
+        for (a = 0; a < (long long)g.gl_pathc; a++) AddTrainFile(g.gl_pathv[a]);
+      }
+      globfree(&g);
+    } else AddTrainFile(train);
+#endif
+  }
+  if (train_file_count == 0) {
+    printf("ERROR: no training data files match %s\n", train);
+    exit(1);
+  }
+}
+
+// Returns the total size of the training files
+long long TrainFileSize() {
+  long long a, size = 0;
+  for (a = 0; a < train_file_count; a++) size += train_file_sizes[a];
+  return size;
+}
+
+// Opens the given training file, or exits
+FILE *OpenTrainFile(int file) {
+  FILE *fin = fopen(train_files[file], "rb");
+  if (fin == NULL) {
+    printf("ERROR: training data file not found: %s\n", train_files[file]);
+    exit(1);
+  }
+  return fin;
+}
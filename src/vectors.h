@@ -0,0 +1,353 @@
+//  Reading of word vector files, shared by distance, word-analogy, w2v-serve,
+//  compute-accuracy and extract.  ReadVectors() accepts every format word2vec
+//  writes: text (-binary 0), binary (-binary 1) and aligned (-binary 2), whose
+//  float16 and int8 matrices it widens to float; ReadQuantizedVectors() keeps
+//  an int8 matrix as it is.
+//  Text files are read in one piece and their lines parsed by several threads.
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "model-format.h"
+
+#define MAX_VECTOR_THREADS 32
+
+static const double parse_pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+  1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Parses a float at p, setting *end past it, in the manner of from_chars: the
+// digits are gathered into an integer and scaled by an exact power of ten in
+// double precision.  Rounding that to float gives the value strtof would,
+// unless the double lies exactly halfway between two floats, where the first
+// rounding may have decided the tie; such values, and the other cases (long
+// mantissas, large exponents, nan, inf), go to strtof.
+static float ParseFloat(const char *p, const char **end) {
+  const char *s = p;
+  unsigned long long m = 0;
+  int digits = 0, e = 0, x = 0, any = 0, neg = 0, eneg = 0;
+  double v;
+  unsigned long long bits;
+  if ((*p == '-') || (*p == '+')) neg = (*p++ == '-');
+  for (; (*p >= '0') && (*p <= '9'); p++, any = 1) {
+    if (digits < 19) {
+      m = m * 10 + (*p - '0');
+      if (m) digits++;
+    } else e++;
+  }
+  if (*p == '.') for (p++; (*p >= '0') && (*p <= '9'); p++, any = 1) {
+    if (digits < 19) {
+      m = m * 10 + (*p - '0');
+      if (m) digits++;
+      e--;
+    }
+  }
+  if (any && ((*p == 'e') || (*p == 'E'))) {
+    p++;
+    if ((*p == '-') || (*p == '+')) eneg = (*p++ == '-');
+    for (; (*p >= '0') && (*p <= '9'); p++) if (x < 10000) x = x * 10 + (*p - '0');
+    e += eneg ? -x : x;
+  }
+  if (!any || (digits > 15) || (e < -22) || (e > 22)) return strtof(s, (char **)end);
+  v = (e < 0) ? m / parse_pow10[-e] : m * parse_pow10[e];
+  // The 29 low bits of the mantissa are those a float drops
+  memcpy(&bits, &v, sizeof(bits));
+  if ((bits & 0x1fffffff) == 0x10000000) return strtof(s, (char **)end);
+  *end = p;
+  return (float)(neg ? -v : v);
+}
+
+static void NormalizeVectors(float *M, long long words, long long size, const float *norms) {
+  long long a, b;
+  float len;
+  for (b = 0; b < words; b++) {
+    if (norms != NULL) len = norms[b];
+    else {
+      len = 0;
+      for (a = 0; a < size; a++) len += M[a + b * size] * M[a + b * size];
+      len = sqrt(len);
+    }
+    for (a = 0; a < size; a++) M[a + b * size] /= len;
+  }
+}
+
+// Reads the header and the words of an aligned model file, leaving the matrix
+// to the caller.  Returns 1 on success, 0 if 'f' is not in that format and -1
+// on error.
+static int ReadAlignedVocab(FILE *f, struct model_file_header *h, long long max_words, long long max_w,
+    long long *words, long long *size, char **vocab) {
+  long long b, *index;
+  char *strings;
+  if ((fread(h, sizeof(*h), 1, f) != 1) || memcmp(h->magic, MODEL_FILE_MAGIC, 8)) return 0;
+  if ((h->version != MODEL_FILE_VERSION) || (h->dtype < MODEL_FLOAT32) || (h->dtype > MODEL_INT8)) {
+    printf("Unsupported model file version %d, type %d\n", h->version, h->dtype);
+    return -1;
+  }
+  *words = h->vocab_size;
+  if ((max_words > 0) && (*words > max_words)) *words = max_words;
+  *size = h->dim;
+  index = (long long *)malloc((*words + 1) * sizeof(long long));
+  *vocab = (char *)malloc(*words * max_w * sizeof(char));
+  if ((index == NULL) || (*vocab == NULL)) {
+    printf("Cannot allocate memory for %lld words\n", *words);
+    return -1;
+  }
+  fseek(f, h->index_offset, SEEK_SET);
+  fread(index, sizeof(long long), *words + 1, f);
+  strings = (char *)malloc(index[*words]);
+  fseek(f, h->strings_offset, SEEK_SET);
+  fread(strings, 1, index[*words], f);
+  for (b = 0; b < *words; b++) {
+    strncpy(*vocab + b * max_w, strings + index[b], max_w - 1);
+    (*vocab)[b * max_w + max_w - 1] = 0;
+  }
+  free(index);
+  free(strings);
+  return 1;
+}
+
+// Reads 'n' floats at 'offset', or zeros if offset is 0
+static float *ReadAlignedFloats(FILE *f, long long offset, long long n) {
+  float *x = (float *)calloc(n, sizeof(float));
+  if ((x != NULL) && (offset != 0)) {
+    fseek(f, offset, SEEK_SET);
+    fread(x, sizeof(float), n, f);
+  }
+  return x;
+}
+
+// Reads an aligned model file; its sections are read in bulk, without
+// parsing, and float16 and int8 matrices are widened to float as they are read.
+// Returns 1 on success, 0 if 'f' is not in that format and -1 on error.
+static int ReadAlignedVectors(FILE *f, long long max_words, long long max_w, long long *words, long long *size,
+    char **vocab, float **M, int normalize) {
+  struct model_file_header h;
+  long long a, b, n, block = 4096;
+  float *norms = NULL, *scales = NULL;
+  unsigned short *half;
+  signed char *q;
+  int r = ReadAlignedVocab(f, &h, max_words, max_w, words, size, vocab);
+  if (r <= 0) return r;
+  *M = (float *)malloc(*words * *size * sizeof(float));
+  if (*M == NULL) {
+    printf("Cannot allocate memory: %lld MB    %lld  %lld\n", *words * *size * (long long)sizeof(float) / 1048576, *words, *size);
+    return -1;
+  }
+  fseek(f, h.matrix_offset, SEEK_SET);
+  if (h.dtype == MODEL_FLOAT32) fread(*M, sizeof(float), *words * *size, f);
+  else if (h.dtype == MODEL_FLOAT16) {
+    half = (unsigned short *)malloc(block * *size * sizeof(unsigned short));
+    for (b = 0; b < *words; b += n) {
+      n = (*words - b < block) ? *words - b : block;
+      fread(half, sizeof(unsigned short), n * *size, f);
+      for (a = 0; a < n * *size; a++) (*M)[b * *size + a] = HalfToFloat(half[a]);
+    }
+    free(half);
+  } else {
+    scales = ReadAlignedFloats(f, h.scales_offset, *words);
+    fseek(f, h.matrix_offset, SEEK_SET);
+    q = (signed char *)malloc(block * *size);
+    for (b = 0; b < *words; b += n) {
+      n = (*words - b < block) ? *words - b : block;
+      fread(q, 1, n * *size, f);
+      for (a = 0; a < n * *size; a++) (*M)[b * *size + a] = q[a] * scales[b + a / *size];
+    }
+    free(q);
+    free(scales);
+  }
+  if (normalize && (h.norms_offset != 0)) norms = ReadAlignedFloats(f, h.norms_offset, *words);
+  if (normalize) NormalizeVectors(*M, *words, *size, norms);
+  free(norms);
+  return 1;
+}
+
+// Reads an int8 aligned model file without widening it: row b of the
+// normalized vectors is Q[b * size ..] times scale[b] (the file's own scale
+// cancels out, so scale[b] is simply one over the norm of the int8 row).  Returns 1 on success,
+// 0 if 'f' holds some other format (and rewinds it) and -1 on error.
+static inline int ReadQuantizedVectors(FILE *f, long long max_w, long long *words, long long *size, char **vocab,
+    signed char **Q, float **scale) {
+  struct model_file_header h;
+  long long a, b;
+  float len;
+  if ((fread(&h, sizeof(h), 1, f) != 1) || memcmp(h.magic, MODEL_FILE_MAGIC, 8) || (h.dtype != MODEL_INT8)) {
+    rewind(f);
+    return 0;
+  }
+  rewind(f);
+  if (ReadAlignedVocab(f, &h, 0, max_w, words, size, vocab) < 0) return -1;
+  *Q = (signed char *)malloc(*words * *size);
+  *scale = (float *)malloc(*words * sizeof(float));
+  if ((*Q == NULL) || (*scale == NULL)) {
+    printf("Cannot allocate memory: %lld MB    %lld  %lld\n", *words * *size / 1048576, *words, *size);
+    return -1;
+  }
+  fseek(f, h.matrix_offset, SEEK_SET);
+  fread(*Q, 1, *words * *size, f);
+  for (b = 0; b < *words; b++) {
+    len = 0;
+    for (a = 0; a < *size; a++) len += (float)(*Q)[a + b * *size] * (*Q)[a + b * *size];
+    (*scale)[b] = (len > 0) ? 1 / sqrt(len) : 0;
+  }
+  return 1;
+}
+
+// Value a of row b of the vectors, from the int8 matrix Q if it is set and
+// from M otherwise
+static inline float RowValue(const float *M, const signed char *Q, const float *scale, long long size, long long b,
+    long long a) {
+  return (Q != NULL) ? Q[a + b * size] * scale[b] : M[a + b * size];
+}
+
+// Returns 1 if the line at p (the first word of the file) holds a word and
+// 'size' numbers, as in the text format, rather than binary floats
+static int IsTextLine(const char *p, const char *end, long long size) {
+  const char *q;
+  long long a;
+  while ((p < end) && (*p != ' ') && (*p != '\n')) p++;
+  for (a = 0; a < size; a++) {
+    while ((p < end) && (*p == ' ')) p++;
+    if ((p >= end) || ((*p != '-') && (*p != '+') && (*p != '.') && ((*p < '0') || (*p > '9')))) return 0;
+    strtof(p, (char **)&q);
+    if ((q == p) || (q > end)) return 0;
+    p = q;
+  }
+  while ((p < end) && (*p == ' ')) p++;
+  return (p == end) || (*p == '\n');
+}
+
+struct text_lines {
+  const char **line;                   // start of each line
+  long long first, last, size, max_w;
+  char *vocab;
+  float *M;
+};
+
+static void *ParseTextThread(void *arg) {
+  struct text_lines *t = (struct text_lines *)arg;
+  long long a, b, n;
+  const char *p, *q;
+  for (b = t->first; b < t->last; b++) {
+    p = t->line[b];
+    for (q = p; (*q != ' ') && (*q != '\n') && (*q != 0); q++);
+    n = (q - p < t->max_w - 1) ? q - p : t->max_w - 1;
+    memcpy(t->vocab + b * t->max_w, p, n);
+    t->vocab[b * t->max_w + n] = 0;
+    p = q;
+    for (a = 0; a < t->size; a++) {
+      while (*p == ' ') p++;
+      t->M[a + b * t->size] = ParseFloat(p, &p);
+    }
+  }
+  return NULL;
+}
+
+// Reads a text format file, which must be NUL-terminated in 'data'
+static int ReadTextVectors(const char *data, long long max_words, long long max_w, long long *words, long long *size,
+    char **vocab, float **M, int normalize) {
+  const char *p = data, **line;
+  long long a, b, threads = sysconf(_SC_NPROCESSORS_ONLN);
+  struct text_lines tasks[MAX_VECTOR_THREADS];
+  pthread_t pt[MAX_VECTOR_THREADS];
+  *words = strtoll(p, (char **)&p, 10);
+  *size = strtoll(p, (char **)&p, 10);
+  if ((max_words > 0) && (*words > max_words)) *words = max_words;
+  line = (const char **)malloc(*words * sizeof(char *));
+  *vocab = (char *)malloc(*words * max_w * sizeof(char));
+  *M = (float *)malloc(*words * *size * sizeof(float));
+  if ((line == NULL) || (*vocab == NULL) || (*M == NULL)) {
+    printf("Cannot allocate memory: %lld MB    %lld  %lld\n", *words * *size * (long long)sizeof(float) / 1048576, *words, *size);
+    return -1;
+  }
+  // Find the start of every line, then share the lines among the threads
+  p = strchr(p, '\n');
+  for (b = 0; b < *words; b++) {
+    if (p == NULL) break;
+    line[b] = p + 1;
+    p = strchr(p + 1, '\n');
+  }
+  if (b < *words) *words = b;
+  if (threads < 1) threads = 1;
+  if (threads > MAX_VECTOR_THREADS) threads = MAX_VECTOR_THREADS;
+  for (a = 0; a < threads; a++) {
+    tasks[a].line = line;
+    tasks[a].first = *words * a / threads;
+    tasks[a].last = *words * (a + 1) / threads;
+    tasks[a].size = *size;
+    tasks[a].max_w = max_w;
+    tasks[a].vocab = *vocab;
+    tasks[a].M = *M;
+    pthread_create(&pt[a], NULL, ParseTextThread, &tasks[a]);
+  }
+  for (a = 0; a < threads; a++) pthread_join(pt[a], NULL);
+  if (normalize) NormalizeVectors(*M, *words, *size, NULL);
+  free(line);
+  return 0;
+}
+
+// Reads a binary format file, positioned after the header line
+static int ReadBinaryVectors(FILE *f, long long max_w, long long words, long long size, char *vocab, float *M,
+    int normalize) {
+  long long a, b;
+  for (b = 0; b < words; b++) {
+    a = 0;
+    while (1) {
+      vocab[b * max_w + a] = fgetc(f);
+      if (feof(f) || (vocab[b * max_w + a] == ' ')) break;
+      if ((a < max_w - 1) && (vocab[b * max_w + a] != '\n')) a++;
+    }
+    vocab[b * max_w + a] = 0;
+    fread(&M[b * size], sizeof(float), size, f);
+  }
+  if (normalize) NormalizeVectors(M, words, size, NULL);
+  return 0;
+}
+
+// Reads the first (at most; 0 means all) max_words word vectors of 'f' into
+// vocab, with max_w characters per word, and M, normalizing the vectors if
+// 'normalize' is set.  Returns 0 on success and -1 on error.
+static int ReadVectors(FILE *f, long long max_words, long long max_w, long long *words, long long *size,
+    char **vocab, float **M, int normalize) {
+  char *data, *head;
+  long long start, length, n, total;
+  int text;
+  int r = ReadAlignedVectors(f, max_words, max_w, words, size, vocab, M, normalize);
+  if (r != 0) return (r > 0) ? 0 : -1;
+  rewind(f);
+  if (fscanf(f, "%lld %lld", words, size) != 2) {
+    printf("Unknown vector file format\n");
+    return -1;
+  }
+  // Look at the first word to tell the text format from the binary one
+  start = ftell(f);
+  head = (char *)malloc((1 << 20) + 1);
+  n = fread(head, 1, 1 << 20, f);
+  head[n] = 0;
+  length = 0;
+  while ((length < n) && (head[length] == '\n')) length++;
+  text = IsTextLine(head + length, head + n, *size);
+  free(head);
+  if (text) {
+    fseek(f, 0, SEEK_END);
+    total = ftell(f);
+    data = (char *)malloc(total + 1);
+    if (data == NULL) {
+      printf("Cannot allocate memory: %lld MB\n", total / 1048576);
+      return -1;
+    }
+    rewind(f);
+    total = fread(data, 1, total, f);
+    data[total] = 0;
+    r = ReadTextVectors(data, max_words, max_w, words, size, vocab, M, normalize);
+    free(data);
+    return r;
+  }
+  fseek(f, start, SEEK_SET);
+  if ((max_words > 0) && (*words > max_words)) *words = max_words;
+  *vocab = (char *)malloc(*words * max_w * sizeof(char));
+  *M = (float *)malloc(*words * *size * sizeof(float));
+  if ((*vocab == NULL) || (*M == NULL)) {
+    printf("Cannot allocate memory: %lld MB    %lld  %lld\n", *words * *size * (long long)sizeof(float) / 1048576, *words, *size);
+    return -1;
+  }
+  return ReadBinaryVectors(f, max_w, *words, *size, *vocab, *M, normalize);
+}
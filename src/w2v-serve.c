@@ -0,0 +1,648 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Nearest neighbor query server.  It loads a model once and answers the
+// queries of distance and word-analogy, and vector lookups, over a Unix
+// domain socket, so that a lookup does not cost a model load.
+//
+// Protocol.  A request is a 4-byte length (in the byte order of the server)
+// followed by that many bytes of text: one query per line, so that a client
+// may send a whole batch at once.  The reply is framed the same way and
+// holds, for each query in order, either "error <message>" or "ok <k>"
+// followed by k result lines.
+//   similar <n> <word> [<word> ...]   the n words closest to the sum of the
+//                                     words' vectors, as distance does;
+//                                     results are "<word> <cosine>"
+//   analogy <n> <a> <b> <c>           the n words closest to b - a + c, as
+//                                     word-analogy does
+//   vector <word>                     the unit vector of the word, as
+//                                     "<word> <value> ..."
+//   stats                             per query type, the number of queries
+//                                     and percentiles of their latency in
+//                                     microseconds
+// The main thread watches the open connections and reads each request as it
+// arrives; once a request is complete it is handed to a pool of threads, so
+// that a client holds a thread only while its request is answered, however
+// long it keeps the connection open.  The model is shared, read-only.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+
+#include "vectors.h"
+
+#define MAX_STRING 4096
+#define MAX_REQUEST (16 << 20)         // largest request, in bytes
+#define MAX_RESULTS 1000               // largest n of a query
+#define MAX_QUERY_WORDS 100            // words of a similar query
+#define MAX_PENDING 1024               // requests waiting for a thread
+#define REPLY_TIMEOUT 30               // seconds a thread waits on a client to take its reply
+#define LATENCY_BUCKETS 512
+
+#define QUERY_SIMILAR 0
+#define QUERY_ANALOGY 1
+#define QUERY_VECTOR 2
+#define QUERY_TYPES 3
+
+const long long max_w = 100;           // max length of vocabulary entries
+const char *query_names[QUERY_TYPES] = {"similar", "analogy", "vector"};
+
+char model_file[MAX_STRING], socket_file[MAX_STRING];
+int debug_mode = 2, num_threads = 12, client_mode = 0;
+long long max_words = 0;
+
+long long words, size, vocab_hash_size;
+float *M = NULL, *scale = NULL;
+signed char *Q = NULL;
+char *vocab;
+long long *vocab_hash;
+
+// Latencies are counted in buckets of an eighth of a power of two of
+// microseconds, so that a percentile is off by at most 12.5%
+long long latency_counts[QUERY_TYPES][LATENCY_BUCKETS];
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// A client connection.  'data' holds the request being read: its 4-byte
+// length, then its text
+struct connection {
+  int fd;
+  char *data;
+  long long size, capacity;
+};
+
+// Connections with a complete request, not yet taken by a thread
+struct connection *pending[MAX_PENDING];
+long long pending_head = 0, pending_count = 0;
+pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER, pending_space = PTHREAD_COND_INITIALIZER;
+// Connections whose request has been answered, to be watched again by the
+// main thread; a byte written to the wake pipe tells it to pick them up
+struct connection **returned = NULL;
+long long returned_count = 0, returned_max = 0;
+int wake_pipe[2];
+// Descriptors watched by the main thread: the listener, the wake pipe, then
+// the connections waiting for a request, whose state is in 'watched'
+struct pollfd *fds = NULL;
+struct connection **watched = NULL;
+long long fd_count = 0, fd_max = 0;
+volatile sig_atomic_t stopping = 0;
+
+static int LatencyBucket(long long us) {
+  int e = 0;
+  if (us < 8) return (us < 0) ? 0 : us;
+  while ((us >> e) >= 16) e++;
+  return (8 * (e + 1) + (us >> e) - 8 < LATENCY_BUCKETS) ? 8 * (e + 1) + (us >> e) - 8 : LATENCY_BUCKETS - 1;
+}
+
+// Returns the smallest latency of the bucket after b, an upper bound of b's
+static long long BucketLimit(int b) {
+  b++;
+  return (b < 8) ? b : (long long)(b % 8 + 8) << (b / 8 - 1);
+}
+
+static long long Microseconds() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+}
+
+void RecordLatency(int type, long long us) {
+  pthread_mutex_lock(&stats_lock);
+  latency_counts[type][LatencyBucket(us)]++;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+// A reply being built
+struct reply {
+  char *data;
+  long long size, capacity;
+};
+
+void Reply(struct reply *r, const char *format, ...) {
+  va_list args;
+  long long n;
+  while (1) {
+    va_start(args, format);
+    n = vsnprintf(r->data + r->size, r->capacity - r->size, format, args);
+    va_end(args);
+    if (r->size + n < r->capacity) break;
+    r->capacity = (r->size + n + 1) * 2;
+    r->data = (char *)realloc(r->data, r->capacity);
+  }
+  r->size += n;
+}
+
+// Writes the latency percentiles of each query type
+void ReplyStats(struct reply *r) {
+  static const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+  long long counts[QUERY_TYPES][LATENCY_BUCKETS], total, seen;
+  int t, b, p;
+  pthread_mutex_lock(&stats_lock);
+  memcpy(counts, latency_counts, sizeof(counts));
+  pthread_mutex_unlock(&stats_lock);
+  Reply(r, "ok %d\n", QUERY_TYPES);
+  for (t = 0; t < QUERY_TYPES; t++) {
+    for (total = 0, b = 0; b < LATENCY_BUCKETS; b++) total += counts[t][b];
+    Reply(r, "%s count %lld", query_names[t], total);
+    for (p = 0; p < 4; p++) {
+      for (seen = 0, b = 0; (b < LATENCY_BUCKETS - 1) && ((seen += counts[t][b]) < percentiles[p] * total); b++);
+      Reply(r, " p%g %lld", percentiles[p] * 100, (total > 0) ? BucketLimit(b) : 0);
+    }
+    for (b = LATENCY_BUCKETS - 1; (b > 0) && (counts[t][b] == 0); b--);
+    Reply(r, " max %lld\n", (total > 0) ? BucketLimit(b) : 0);
+  }
+}
+
+static unsigned long long WordHash(const char *word) {
+  unsigned long long hash = 1;
+  for (; *word; word++) hash = hash * 257 + (unsigned char)*word;
+  return hash;
+}
+
+// Returns the id of a word of the model, or -1
+long long SearchVocab(const char *word) {
+  long long i = WordHash(word) % vocab_hash_size;
+  while (vocab_hash[i] != -1) {
+    if (!strcmp(&vocab[vocab_hash[i] * max_w], word)) return vocab_hash[i];
+    i = (i + 1) % vocab_hash_size;
+  }
+  return -1;
+}
+
+void BuildVocabHash() {
+  long long a, i;
+  vocab_hash_size = words * 2 + 1;
+  vocab_hash = (long long *)malloc(vocab_hash_size * sizeof(long long));
+  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
+  // Later duplicates (there should be none) are left out, as the linear
+  // search of distance would never find them
+  for (a = 0; a < words; a++) {
+    if (SearchVocab(&vocab[a * max_w]) != -1) continue;
+    for (i = WordHash(&vocab[a * max_w]) % vocab_hash_size; vocab_hash[i] != -1; i = (i + 1) % vocab_hash_size);
+    vocab_hash[i] = a;
+  }
+}
+
+// Adds to the reply the n words nearest to the direction of 'vec', leaving
+// out the rows in 'skip'
+void ReplyNearest(struct reply *r, float *vec, long long n, const long long *skip, int skip_count) {
+  long long a, b, c, d, best[MAX_RESULTS];
+  float dist, len = 0, bestd[MAX_RESULTS];
+  for (a = 0; a < size; a++) len += vec[a] * vec[a];
+  len = sqrt(len);
+  if (len > 0) for (a = 0; a < size; a++) vec[a] /= len;
+  for (a = 0; a < n; a++) {
+    bestd[a] = -1;
+    best[a] = -1;
+  }
+  for (c = 0; c < words; c++) {
+    dist = 0;
+    if (Q != NULL) {
+      for (a = 0; a < size; a++) dist += vec[a] * Q[a + c * size];
+      dist *= scale[c];
+    } else for (a = 0; a < size; a++) dist += vec[a] * M[a + c * size];
+    if (dist <= bestd[n - 1]) continue;
+    for (b = 0; b < skip_count; b++) if (skip[b] == c) break;
+    if (b < skip_count) continue;
+    for (a = 0; dist <= bestd[a]; a++);
+    for (d = n - 1; d > a; d--) {
+      bestd[d] = bestd[d - 1];
+      best[d] = best[d - 1];
+    }
+    bestd[a] = dist;
+    best[a] = c;
+  }
+  for (a = 0; (a < n) && (best[a] != -1); a++);
+  Reply(r, "ok %lld\n", a);
+  for (a = 0; (a < n) && (best[a] != -1); a++) Reply(r, "%s %f\n", &vocab[best[a] * max_w], bestd[a]);
+}
+
+// Answers one query line, returning its type, or -1 for a stats query or an
+// error
+int Answer(struct reply *r, char *line, float *vec) {
+  char *token[MAX_QUERY_WORDS + 2], *save;
+  long long ids[MAX_QUERY_WORDS], a, b, n = 0;
+  int count = 0, first, type;
+  for (token[0] = strtok_r(line, " \t\r", &save); token[count] != NULL; token[count] = strtok_r(NULL, " \t\r", &save)) {
+    if (++count == MAX_QUERY_WORDS + 2) {
+      Reply(r, "error too many words\n");
+      return -1;
+    }
+  }
+  if (count == 0) {
+    Reply(r, "error empty query\n");
+    return -1;
+  }
+  if (!strcmp(token[0], "stats")) {
+    ReplyStats(r);
+    return -1;
+  }
+  for (type = 0; (type < QUERY_TYPES) && strcmp(token[0], query_names[type]); type++);
+  if (type == QUERY_TYPES) {
+    Reply(r, "error unknown query %s\n", token[0]);
+    return -1;
+  }
+  if (type != QUERY_VECTOR) {
+    n = (count > 1) ? atoll(token[1]) : 0;
+    if ((n < 1) || (n > MAX_RESULTS)) {
+      Reply(r, "error n must be between 1 and %d\n", MAX_RESULTS);
+      return -1;
+    }
+  }
+  if (((type == QUERY_SIMILAR) && (count < 3)) || ((type == QUERY_ANALOGY) && (count != 5))
+      || ((type == QUERY_VECTOR) && (count != 2))) {
+    Reply(r, "error wrong number of words for %s\n", query_names[type]);
+    return -1;
+  }
+  first = (type == QUERY_VECTOR) ? 1 : 2;
+  for (a = first; a < count; a++) {
+    ids[a - first] = b = SearchVocab(token[a]);
+    if (b == -1) {
+      Reply(r, "error out of dictionary word %s\n", token[a]);
+      return -1;
+    }
+  }
+  if (type == QUERY_VECTOR) {
+    Reply(r, "ok 1\n%s", token[1]);
+    for (a = 0; a < size; a++) Reply(r, " %.9g", RowValue(M, Q, scale, size, ids[0], a));
+    Reply(r, "\n");
+    return type;
+  }
+  for (a = 0; a < size; a++) vec[a] = 0;
+  if (type == QUERY_SIMILAR) {
+    for (b = 0; b < count - 2; b++) for (a = 0; a < size; a++) vec[a] += RowValue(M, Q, scale, size, ids[b], a);
+  } else {
+    for (a = 0; a < size; a++) {
+      vec[a] = RowValue(M, Q, scale, size, ids[1], a) - RowValue(M, Q, scale, size, ids[0], a)
+        + RowValue(M, Q, scale, size, ids[2], a);
+    }
+  }
+  ReplyNearest(r, vec, n, ids, count - 2);
+  return type;
+}
+
+// Answers every query of a request
+void AnswerRequest(struct reply *r, char *request) {
+  char *line, *next;
+  float *vec = (float *)malloc(size * sizeof(float));
+  long long start;
+  int type;
+  r->size = 0;
+  for (line = request; line != NULL; line = next) {
+    next = strchr(line, '\n');
+    if (next != NULL) *next++ = 0;
+    if ((next == NULL) && (*line == 0) && (line != request)) break;
+    start = Microseconds();
+    type = Answer(r, line, vec);
+    if (type >= 0) RecordLatency(type, Microseconds() - start);
+  }
+  free(vec);
+}
+
+int WriteAll(int fd, const void *data, long long size) {
+  const char *p = (const char *)data;
+  long long n;
+  while (size > 0) {
+    n = write(fd, p, size);
+    if (n <= 0) return 0;
+    p += n;
+    size -= n;
+  }
+  return 1;
+}
+
+int ReadAll(int fd, void *data, long long size) {
+  char *p = (char *)data;
+  long long n;
+  while (size > 0) {
+    n = read(fd, p, size);
+    if (n <= 0) return 0;
+    p += n;
+    size -= n;
+  }
+  return 1;
+}
+
+// Reads what has arrived of the connection's request, without blocking;
+// returns 1 once the request is complete, 0 if more is to come and -1 if the
+// connection was closed or the request is too long
+int ReadRequest(struct connection *c) {
+  unsigned int length;
+  long long need, n;
+  while (1) {
+    need = sizeof(length);
+    if (c->size >= need) {
+      memcpy(&length, c->data, sizeof(length));
+      if (length > MAX_REQUEST) return -1;
+      need += length;
+      if (c->size == need) return 1;
+    }
+    if (need + 1 > c->capacity) {
+      c->capacity = need + 1;
+      c->data = (char *)realloc(c->data, c->capacity);
+    }
+    n = recv(c->fd, c->data + c->size, need - c->size, MSG_DONTWAIT);
+    if (n == 0) return -1;
+    if (n < 0) return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+    c->size += n;
+  }
+}
+
+void CloseConnection(struct connection *c) {
+  close(c->fd);
+  free(c->data);
+  free(c);
+}
+
+void *ServeThread(void *id) {
+  unsigned int length;
+  struct connection *c;
+  struct reply r = {NULL, 0, 0};
+  while (1) {
+    pthread_mutex_lock(&pending_lock);
+    while (pending_count == 0) pthread_cond_wait(&pending_cond, &pending_lock);
+    c = pending[pending_head];
+    pending_head = (pending_head + 1) % MAX_PENDING;
+    pending_count--;
+    pthread_cond_signal(&pending_space);
+    pthread_mutex_unlock(&pending_lock);
+    c->data[c->size] = 0;
+    AnswerRequest(&r, c->data + sizeof(length));
+    c->size = 0;
+    length = r.size;
+    if (!WriteAll(c->fd, &length, sizeof(length)) || !WriteAll(c->fd, r.data, r.size)) {
+      CloseConnection(c);
+      continue;
+    }
+    pthread_mutex_lock(&pending_lock);
+    if (returned_count == returned_max) {
+      returned_max = returned_max * 2 + 16;
+      returned = (struct connection **)realloc(returned, returned_max * sizeof(struct connection *));
+    }
+    returned[returned_count++] = c;
+    pthread_mutex_unlock(&pending_lock);
+    // The pipe is non-blocking: if it is full, the main thread is already due
+    // to wake up
+    write(wake_pipe[1], "", 1);
+  }
+  return NULL;
+}
+
+void Stop(int sig) {
+  stopping = 1;
+}
+
+// Fills 'un' with the address of the socket; returns 0 if its path is too long
+int SocketAddress(struct sockaddr_un *un) {
+  memset(un, 0, sizeof(*un));
+  un->sun_family = AF_UNIX;
+  if (strlen(socket_file) >= sizeof(un->sun_path)) return 0;
+  memcpy(un->sun_path, socket_file, strlen(socket_file) + 1);
+  return 1;
+}
+
+// Opens the socket for listening; returns -1 on failure
+int ListenSocket() {
+  struct sockaddr_un un;
+  int fd;
+  if (!SocketAddress(&un) || ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)) return -1;
+  unlink(un.sun_path);
+  if ((bind(fd, (struct sockaddr *)&un, sizeof(un)) != 0) || (listen(fd, 64) != 0)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Queues a connection with a complete request for the pool
+void Dispatch(struct connection *c) {
+  pthread_mutex_lock(&pending_lock);
+  while (pending_count == MAX_PENDING) pthread_cond_wait(&pending_space, &pending_lock);
+  pending[(pending_head + pending_count) % MAX_PENDING] = c;
+  pending_count++;
+  pthread_cond_signal(&pending_cond);
+  pthread_mutex_unlock(&pending_lock);
+}
+
+// Adds a descriptor, and the connection it belongs to if any, to those
+// watched by poll()
+void Watch(int fd, struct connection *c) {
+  if (fd_count == fd_max) {
+    fd_max = fd_max * 2 + 16;
+    fds = (struct pollfd *)realloc(fds, fd_max * sizeof(struct pollfd));
+    watched = (struct connection **)realloc(watched, fd_max * sizeof(struct connection *));
+  }
+  fds[fd_count].fd = fd;
+  fds[fd_count].events = POLLIN;
+  fds[fd_count].revents = 0;
+  watched[fd_count] = c;
+  fd_count++;
+}
+
+void Serve() {
+  int fd, listener, ready;
+  long long a;
+  char drain[256];
+  struct connection *c;
+  struct timeval timeout = {REPLY_TIMEOUT, 0};
+  struct sigaction action;
+  struct reply r = {NULL, 0, 0};
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  FILE *f = fopen(model_file, "rb");
+  if (f == NULL) {
+    printf("ERROR: model file not found: %s\n", model_file);
+    exit(1);
+  }
+  // int8 models are searched as they are, in a quarter of the memory
+  a = (max_words > 0) ? 0 : ReadQuantizedVectors(f, max_w, &words, &size, &vocab, &Q, &scale);
+  if ((a < 0) || ((a == 0) && (ReadVectors(f, max_words, max_w, &words, &size, &vocab, &M, 1) < 0))) exit(1);
+  fclose(f);
+  BuildVocabHash();
+  if (debug_mode > 0) printf("Loaded %lld words of size %lld from %s\n", words, size, model_file);
+  listener = ListenSocket();
+  if (listener < 0) {
+    printf("ERROR: can not listen on %s\n", socket_file);
+    exit(1);
+  }
+  if ((pipe(wake_pipe) != 0) || (fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK) != 0)) {
+    printf("ERROR: can not create a pipe\n");
+    exit(1);
+  }
+  // A client that goes away must not take the server with it; SIGINT and
+  // SIGTERM interrupt poll() to stop the server
+  signal(SIGPIPE, SIG_IGN);
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = Stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, ServeThread, NULL);
+  if (debug_mode > 0) {
+    printf("Serving on %s with %d threads\n", socket_file, num_threads);
+    fflush(stdout);
+  }
+  // A connection leaves the watched set while a thread answers its request,
+  // and is returned to it after the reply
+  Watch(listener, NULL);
+  Watch(wake_pipe[0], NULL);
+  while (!stopping) {
+    if (poll(fds, fd_count, -1) < 0) {
+      if (errno == EINTR) continue;
+      printf("ERROR: poll failed on %s\n", socket_file);
+      break;
+    }
+    for (a = 2; a < fd_count; a++) if (fds[a].revents != 0) {
+      c = watched[a];
+      ready = ReadRequest(c);
+      if (ready == 0) continue;
+      fd_count--;
+      fds[a] = fds[fd_count];
+      watched[a] = watched[fd_count];
+      a--;
+      if (ready > 0) Dispatch(c); else CloseConnection(c);
+    }
+    if (fds[1].revents != 0) {
+      read(wake_pipe[0], drain, sizeof(drain));
+      pthread_mutex_lock(&pending_lock);
+      for (a = 0; a < returned_count; a++) Watch(returned[a]->fd, returned[a]);
+      returned_count = 0;
+      pthread_mutex_unlock(&pending_lock);
+    }
+    if (fds[0].revents != 0) {
+      fd = accept(listener, NULL, NULL);
+      if (fd < 0) {
+        if ((errno == EINTR) || (errno == ECONNABORTED)) continue;
+        printf("ERROR: accept failed on %s\n", socket_file);
+        break;
+      }
+      // A client that does not take its reply releases the thread after
+      // REPLY_TIMEOUT seconds
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      c = (struct connection *)calloc(1, sizeof(struct connection));
+      c->fd = fd;
+      Watch(fd, c);
+    }
+  }
+  close(listener);
+  unlink(socket_file);
+  if (debug_mode > 0) {
+    ReplyStats(&r);
+    printf("Latency (microseconds):\n%s", r.data + strcspn(r.data, "\n") + 1);
+  }
+  exit(0);
+}
+
+// Sends the queries read from stdin, in batches of up to 'batch' lines, and
+// prints the replies
+int Query(int batch) {
+  char line[MAX_STRING];
+  struct reply request = {NULL, 0, 0};
+  char *data = NULL;
+  unsigned int length;
+  int n, fd = -1;
+  struct sockaddr_un un;
+  if (!SocketAddress(&un) || ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+      || (connect(fd, (struct sockaddr *)&un, sizeof(un)) != 0)) {
+    printf("ERROR: can not connect to %s\n", socket_file);
+    return 1;
+  }
+  while (1) {
+    request.size = 0;
+    for (n = 0; (n < batch) && (fgets(line, MAX_STRING, stdin) != NULL); n++) Reply(&request, "%s", line);
+    if (n == 0) break;
+    if ((request.data[request.size - 1] == '\n')) request.size--;
+    length = request.size;
+    if (!WriteAll(fd, &length, sizeof(length)) || !WriteAll(fd, request.data, request.size)
+        || !ReadAll(fd, &length, sizeof(length))) break;
+    data = (char *)realloc(data, length);
+    if (!ReadAll(fd, data, length)) break;
+    fwrite(data, 1, length, stdout);
+    fflush(stdout);
+    if (n < batch) break;
+  }
+  close(fd);
+  free(data);
+  free(request.data);
+  return 0;
+}
+
+int ArgPos(char *str, int argc, char **argv) {
+  int a;
+  for (a = 1; a < argc; a++) if (!strcmp(str, argv[a])) {
+    if (a == argc - 1) {
+      printf("Argument missing for %s\n", str);
+      exit(1);
+    }
+    return a;
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  int i;
+  if (argc == 1) {
+    printf("WORD VECTOR QUERY SERVER\n\n");
+    printf("Options:\n");
+    printf("\t-model <file>\n");
+    printf("\t\tServe the word vectors of <file>, in any format written by word2vec\n");
+    printf("\t-socket <file>\n");
+    printf("\t\tListen on the Unix domain socket <file>\n");
+    printf("\t-threads <int>\n");
+    printf("\t\tAnswer up to <int> requests at a time (default 12)\n");
+    printf("\t-max-words <int>\n");
+    printf("\t\tOnly load the first <int> words of the model; default is 0 (all of them)\n");
+    printf("\t-query <int>\n");
+    printf("\t\tInstead of serving, send the queries read from the standard input to the server at -socket, in\n");
+    printf("\t\tbatches of <int> lines, and print the replies\n");
+    printf("\t-debug <int>\n");
+    printf("\t\tSet the debug mode (default = 2 = more info)\n");
+    printf("\nQueries, one per line:\n");
+    printf("\tsimilar <n> <word> [<word> ...]\n\tanalogy <n> <a> <b> <c>\n\tvector <word>\n\tstats\n");
+    printf("\nExamples:\n");
+    printf("./w2v-serve -model vectors.bin -socket /tmp/w2v.sock\n");
+    printf("echo 'similar 10 france' | ./w2v-serve -socket /tmp/w2v.sock -query 1\n\n");
+    return 0;
+  }
+  model_file[0] = 0;
+  socket_file[0] = 0;
+  if ((i = ArgPos((char *)"-model", argc, argv)) > 0) strcpy(model_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-socket", argc, argv)) > 0) strcpy(socket_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_threads = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-max-words", argc, argv)) > 0) max_words = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-query", argc, argv)) > 0) client_mode = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
+  if (num_threads < 1) num_threads = 1;
+  if (socket_file[0] == 0) {
+    printf("ERROR: -socket is required\n");
+    return 1;
+  }
+  if (client_mode > 0) return Query(client_mode);
+  if (model_file[0] == 0) {
+    printf("ERROR: -model is required\n");
+    return 1;
+  }
+  Serve();
+  return 0;
+}
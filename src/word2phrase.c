@@ -18,9 +18,15 @@
 #include <math.h>
 #include <pthread.h>
 
+#include "train-files.h"
+
 #define MAX_STRING 60
+#define CHUNK_BYTES (1 << 22)          // Size of the pieces of text given to each thread
+
+#define MAX_PASSES 16                   // Maximum number of -thresholds
+#define SKETCH_DEPTH 4                  // Rows of the count-min sketch of -memory-budget
 
-const int vocab_hash_size = 500000000; // Maximum 500M entries in the vocabulary
+const long long max_table_entries = 350000000;  // Maximum 350M words or bigrams in the counting tables
 
 typedef float real;                    // Precision of float numbers
 
@@ -29,44 +35,124 @@ struct vocab_word {
   char *word;
 };
 
-char train_file[MAX_STRING], output_file[MAX_STRING];
+char train_file[MAX_PATH_STRING], output_file[MAX_PATH_STRING], save_phrases_file[MAX_PATH_STRING];
 struct vocab_word *vocab;
-int debug_mode = 2, min_count = 5, *vocab_hash, min_reduce = 1;
-long long vocab_max_size = 10000, vocab_size = 0;
+int debug_mode = 2, min_count = 5, *vocab_hash, num_threads = 12;
+long long vocab_size = 0, vocab_max_size = 0, vocab_hash_size, memory_budget = 0;
 long long train_words = 0;
-real threshold = 100;
+real threshold = 100, thresholds[MAX_PASSES];
+int pass_count = 1;
 
 unsigned long long next_random = 1;
 
-// Reads a single word from a file, assuming space + tab + EOL to be word boundaries
-void ReadWord(char *word, FILE *fin) {
-  int a = 0, ch;
-  while (!feof(fin)) {
-    ch = fgetc(fin);
-    if (ch == 13) continue;
-    if ((ch == ' ') || (ch == '\t') || (ch == '\n')) {
-      if (a > 0) {
-        if (ch == '\n') ungetc(ch, fin);
-        break;
-      }
-      if (ch == '\n') {
+// Reads the next word of the text at p, before end, assuming space + tab +
+// EOL to be word boundaries; a newline is returned as </s>.  Returns the
+// position after the word, or NULL at the end of the text.
+char *NextWord(char *p, char *end, char *word) {
+  int a = 0;
+  while (p < end) {
+    if (*p == 13) {
+      p++;
+      continue;
+    }
+    if ((*p == ' ') || (*p == '\t') || (*p == '\n')) {
+      if (a > 0) break;
+      if (*p++ == '\n') {
         strcpy(word, (char *)"</s>");
-        return;
+        return p;
       } else continue;
     }
-    word[a] = ch;
+    word[a] = *p++;
     a++;
     if (a >= MAX_STRING - 1) a--;   // Truncate too long words
   }
   word[a] = 0;
+  return (a > 0) ? p : NULL;
+}
+
+// The training files are handed to the threads in chunks of about
+// CHUNK_BYTES of whole lines, so that no word or bigram spans two chunks; a
+// file that does not end with a newline is given one
+struct text_chunk {
+  char *data;
+  long long size, capacity, words;
+};
+
+pthread_mutex_t input_lock = PTHREAD_MUTEX_INITIALIZER;
+FILE *input = NULL;
+int input_file = 0;
+char *carry = NULL;                    // start of a line read past the end of the last chunk
+long long carry_size = 0, words_read = 0;
+const char *progress_label;
+
+// Starts reading the training files from the beginning
+void RewindInput(const char *label) {
+  input_file = 0;
+  carry_size = 0;
+  words_read = 0;
+  progress_label = label;
+}
+
+// Fills 'c' with the next chunk of the input, first adding the number of words
+// in the chunk it held before to the progress count.  Returns 0 at the end.
+int NextChunk(struct text_chunk *c) {
+  long long a, n;
+  pthread_mutex_lock(&input_lock);
+  words_read += c->words;
+  if ((debug_mode > 1) && (c->words > 0)) {
+    printf("%s: %lldK%c", progress_label, words_read / 1000, 13);
+    fflush(stdout);
+  }
+  c->words = 0;
+  if (c->capacity < CHUNK_BYTES + carry_size + 1) {
+    c->capacity = CHUNK_BYTES + carry_size + 1;
+    c->data = (char *)realloc(c->data, c->capacity);
+  }
+  memcpy(c->data, carry, carry_size);
+  c->size = carry_size;
+  carry_size = 0;
+  while (1) {
+    if (input == NULL) {
+      if (input_file == train_file_count) break;
+      input = OpenTrainFile(input_file++);
+    }
+    if (c->capacity < c->size + CHUNK_BYTES + 1) {
+      c->capacity = c->size + CHUNK_BYTES + 1;
+      c->data = (char *)realloc(c->data, c->capacity);
+    }
+    n = fread(c->data + c->size, 1, CHUNK_BYTES, input);
+    if (n == 0) {
+      fclose(input);
+      input = NULL;
+      if ((c->size > 0) && (c->data[c->size - 1] != '\n')) c->data[c->size++] = '\n';
+      if (c->size > 0) break;
+      continue;
+    }
+    c->size += n;
+    // Keep the last partial line for the next chunk
+    for (a = c->size; (a > c->size - n) && (c->data[a - 1] != '\n'); a--);
+    if (a > c->size - n) {
+      carry = (char *)realloc(carry, c->size - a + 1);
+      carry_size = c->size - a;
+      memcpy(carry, c->data + a, carry_size);
+      c->size = a;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&input_lock);
+  return c->size > 0;
+}
+
+// Returns hash value of a word, before it is reduced to a table size
+unsigned long long WordHash(const char *word) {
+  unsigned long long hash = 1;
+  for (; *word; word++) hash = hash * 257 + *word;
+  return hash;
 }
 
 // Returns hash value of a word
 int GetWordHash(char *word) {
-  unsigned long long a, hash = 1;
-  for (a = 0; a < strlen(word); a++) hash = hash * 257 + word[a];
-  hash = hash % vocab_hash_size;
-  return hash;
+  return WordHash(word) % vocab_hash_size;
 }
 
 // Returns position of a word in the vocabulary; if the word is not found, returns -1
@@ -80,40 +166,14 @@ int SearchVocab(char *word) {
   return -1;
 }
 
-// Reads a word and returns its index in the vocabulary
-int ReadWordIndex(FILE *fin) {
-  char word[MAX_STRING];
-  ReadWord(word, fin);
-  if (feof(fin)) return -1;
-  return SearchVocab(word);
-}
-
-// Adds a word to the vocabulary
-int AddWordToVocab(char *word) {
-  unsigned int hash, length = strlen(word) + 1;
-  if (length > MAX_STRING) length = MAX_STRING;
-  vocab[vocab_size].word = (char *)calloc(length, sizeof(char));
-  strcpy(vocab[vocab_size].word, word);
-  vocab[vocab_size].cn = 0;
-  vocab_size++;
-  // Reallocate memory if needed
-  if (vocab_size + 2 >= vocab_max_size) {
-    vocab_max_size += 10000;
-    vocab=(struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
-  }
-  hash = GetWordHash(word);
-  while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-  vocab_hash[hash]=vocab_size - 1;
-  return vocab_size - 1;
-}
-
 // Used later for sorting by word counts
 int VocabCompare(const void *a, const void *b) {
     return ((struct vocab_word *)b)->cn - ((struct vocab_word *)a)->cn;
 }
 
-// Sorts the vocabulary by frequency using word counts
-void SortVocab() {
+// Sorts the vocabulary by frequency using word counts, discarding the words
+// seen less than 'min' times
+void SortVocab(long long min) {
   int a;
   unsigned int hash;
   // Sort the vocabulary and keep </s> at the first position
@@ -121,7 +181,7 @@ void SortVocab() {
   for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
   for (a = 0; a < vocab_size; a++) {
     // Words occuring less than min_count times will be discarded from the vocab
-    if (vocab[a].cn < min_count) {
+    if (vocab[a].cn < min) {
       vocab_size--;
       free(vocab[vocab_size].word);
     } else {
@@ -132,120 +192,825 @@ void SortVocab() {
     }
   }
   vocab = (struct vocab_word *)realloc(vocab, vocab_size * sizeof(struct vocab_word));
+  vocab_max_size = vocab_size;
 }
 
-// Reduces the vocabulary by removing infrequent tokens
-void ReduceVocab() {
-  int a, b = 0;
-  unsigned int hash;
-  for (a = 0; a < vocab_size; a++) if (vocab[a].cn > min_reduce) {
-    vocab[b].cn = vocab[a].cn;
-    vocab[b].word = vocab[a].word;
-    b++;
-  } else free(vocab[a].word);
-  vocab_size = b;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  for (a = 0; a < vocab_size; a++) {
-    // Hash will be re-computed, as it is not actual
-    hash = GetWordHash(vocab[a].word);
-    while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-    vocab_hash[hash] = a;
+// Unigrams are counted by num_threads threads, each into its own
+// num_threads shards, split by hash; shard p of every thread is then merged
+// by thread p.  A shard is an open addressing table of words and counts.
+struct count_shard {
+  long long size, used;                // size is a power of two
+  struct vocab_word *entry;            // entry[i].word is NULL for free slots
+};
+
+// Once the vocabulary is known, bigrams are counted the same way, under
+// packed (unigram id, unigram id) keys; no key is 0, as id 0 is </s>
+struct pair_entry {
+  unsigned long long key;
+  long long cn;
+};
+
+struct pair_shard {
+  long long size, used;
+  struct pair_entry *entry;            // entry[i].key is 0 for free slots
+};
+
+struct count_shard *shards;            // shard p of thread t is shards[t * num_threads + p]
+struct pair_shard *pair_shards = NULL; // likewise; after merging, shards 0 .. num_threads - 1 hold all bigrams
+long long bigram_count = 0;
+int *min_reduce;                       // per thread
+
+// Spreads the bits of a word hash or bigram key; the shard is chosen by the
+// high half and the slot by the low half
+static inline unsigned long long MixHash(unsigned long long hash) {
+  hash *= 0x9E3779B97F4A7C15ULL;
+  return hash ^ (hash >> 29);
+}
+
+static inline unsigned long long PairKey(long long a, long long b) {
+  return ((unsigned long long)a << 32) | b;
+}
+
+void ShardInit(struct count_shard *s, long long size) {
+  s->size = size;
+  s->used = 0;
+  s->entry = (struct vocab_word *)calloc(size, sizeof(struct vocab_word));
+}
+
+// Adds cn to the count of 'word', which is copied into the shard if it is
+// new there and 'copy' is set, or else handed over to it (and freed if the
+// shard already has the word)
+void ShardAdd(struct count_shard *s, char *word, unsigned long long mix, long long cn, int copy) {
+  long long a, i = mix & (s->size - 1);
+  struct count_shard grown;
+  while (s->entry[i].word != NULL) {
+    if (!strcmp(s->entry[i].word, word)) {
+      s->entry[i].cn += cn;
+      if (!copy) free(word);
+      return;
+    }
+    i = (i + 1) & (s->size - 1);
   }
-  fflush(stdout);
-  min_reduce++;
+  s->entry[i].word = copy ? strdup(word) : word;
+  s->entry[i].cn = cn;
+  if (++s->used * 2 <= s->size) return;
+  ShardInit(&grown, s->size * 2);
+  for (a = 0; a < s->size; a++) if (s->entry[a].word != NULL) {
+    ShardAdd(&grown, s->entry[a].word, MixHash(WordHash(s->entry[a].word)), s->entry[a].cn, 0);
+  }
+  free(s->entry);
+  *s = grown;
+}
+
+void PairShardInit(struct pair_shard *s, long long size) {
+  s->size = size;
+  s->used = 0;
+  s->entry = (struct pair_entry *)calloc(size, sizeof(struct pair_entry));
+}
+
+void PairShardAdd(struct pair_shard *s, unsigned long long key, long long cn) {
+  long long a, i = MixHash(key) & (s->size - 1);
+  struct pair_shard grown;
+  while (s->entry[i].key != 0) {
+    if (s->entry[i].key == key) {
+      s->entry[i].cn += cn;
+      return;
+    }
+    i = (i + 1) & (s->size - 1);
+  }
+  s->entry[i].key = key;
+  s->entry[i].cn = cn;
+  if (++s->used * 2 <= s->size) return;
+  PairShardInit(&grown, s->size * 2);
+  for (a = 0; a < s->size; a++) if (s->entry[a].key != 0) PairShardAdd(&grown, s->entry[a].key, s->entry[a].cn);
+  free(s->entry);
+  *s = grown;
+}
+
+// With -memory-budget, the bigram counts are kept in a count-min sketch of
+// SKETCH_DEPTH rows of sketch_width saturating counters, with conservative
+// update: a count is raised only as far as needed for its smallest counter to
+// reach the new total.  Each thread still adds up its bigrams in its shards,
+// which are flushed into the sketch as soon as their tables outgrow the
+// thread's share of the budget, so that frequent bigrams reach the sketch in
+// few, large updates.
+// An estimate is never below the true count and, with probability at least
+// 1 - e^-SKETCH_DEPTH, no more than e / sketch_width times the number of
+// bigrams above it.
+unsigned int *sketch = NULL;
+long long sketch_width, sketch_total = 0;
+long long sketch_flush_entries;        // table entries of the shards of a thread
+long long sketch_shard_size;           // size a shard starts at, and returns to after a flush
+pthread_mutex_t sketch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline long long SketchSlot(unsigned long long key, int row) {
+  return row * sketch_width + MixHash(key + (row + 1) * 0xD6E8FEB86659FD93ULL) % sketch_width;
+}
+
+long long SketchCount(unsigned long long key) {
+  long long min = 0xffffffffLL;
+  int r;
+  for (r = 0; r < SKETCH_DEPTH; r++) if (sketch[SketchSlot(key, r)] < min) min = sketch[SketchSlot(key, r)];
+  return min;
+}
+
+// Adds the bigrams in the shards of thread t to the sketch and empties them,
+// shrinking those that grew back to their share
+void FlushPairShards(int t) {
+  long long a, v, slot[SKETCH_DEPTH];
+  int p, r;
+  struct pair_shard *s;
+  pthread_mutex_lock(&sketch_lock);
+  for (p = 0; p < num_threads; p++) {
+    s = &pair_shards[t * num_threads + p];
+    for (a = 0; a < s->size; a++) if (s->entry[a].key != 0) {
+      for (r = 0; r < SKETCH_DEPTH; r++) slot[r] = SketchSlot(s->entry[a].key, r);
+      v = SketchCount(s->entry[a].key) + s->entry[a].cn;
+      if (v > 0xffffffffLL) v = 0xffffffffLL;
+      for (r = 0; r < SKETCH_DEPTH; r++) if (sketch[slot[r]] < v) sketch[slot[r]] = v;
+      sketch_total += s->entry[a].cn;
+    }
+    if (s->size > sketch_shard_size) {
+      free(s->entry);
+      PairShardInit(s, sketch_shard_size);
+    } else {
+      memset(s->entry, 0, s->size * sizeof(struct pair_entry));
+      s->used = 0;
+    }
+  }
+  pthread_mutex_unlock(&sketch_lock);
+}
+
+// Adds an occurrence of bigram 'key' to the shards of thread t; with a memory
+// budget, they are flushed once a shard growing takes them over their share
+void AddPair(int t, unsigned long long key) {
+  struct pair_shard *s = &pair_shards[t * num_threads + (MixHash(key) >> 32) % num_threads];
+  long long size = s->size, entries;
+  int p;
+  PairShardAdd(s, key, 1);
+  if ((sketch == NULL) || (s->size == size)) return;
+  for (entries = 0, p = 0; p < num_threads; p++) entries += pair_shards[t * num_threads + p].size;
+  if (entries > sketch_flush_entries) FlushPairShards(t);
+}
+
+// Returns the entry of 'key' in s, or NULL if it has none
+struct pair_entry *PairShardFind(struct pair_shard *s, unsigned long long key) {
+  long long i = MixHash(key) & (s->size - 1);
+  while (s->entry[i].key != 0) {
+    if (s->entry[i].key == key) return &s->entry[i];
+    i = (i + 1) & (s->size - 1);
+  }
+  return NULL;
+}
+
+// Returns the count of bigram (a, b), or 0 if it was not kept
+long long PairCount(long long a, long long b) {
+  unsigned long long key = PairKey(a, b);
+  struct pair_entry *e;
+  long long cn;
+  if (sketch != NULL) {
+    cn = SketchCount(key);
+    return (cn >= min_count) ? cn : 0;
+  }
+  e = PairShardFind(&pair_shards[(MixHash(key) >> 32) % num_threads], key);
+  return (e != NULL) ? e->cn : 0;
+}
+
+// Reduces the shards of thread t by removing infrequent tokens
+void ReduceShards(int t) {
+  long long a;
+  int p;
+  struct count_shard *s, reduced;
+  for (p = 0; p < num_threads; p++) {
+    s = &shards[t * num_threads + p];
+    ShardInit(&reduced, s->size);
+    for (a = 0; a < s->size; a++) if (s->entry[a].word != NULL) {
+      if (s->entry[a].cn > min_reduce[t]) ShardAdd(&reduced, s->entry[a].word, MixHash(WordHash(s->entry[a].word)), s->entry[a].cn, 0);
+      else free(s->entry[a].word);
+    }
+    free(s->entry);
+    *s = reduced;
+  }
+  min_reduce[t]++;
+}
+
+// Likewise for the bigram shards of thread t, or, with t = -1, removes the
+// merged bigrams seen less than 'limit' times
+void ReducePairShards(int t, long long limit) {
+  long long a;
+  int p;
+  struct pair_shard *s, reduced;
+  for (p = 0; p < num_threads; p++) {
+    s = (t < 0) ? &pair_shards[p] : &pair_shards[t * num_threads + p];
+    PairShardInit(&reduced, (t < 0) ? 1024 : s->size);
+    for (a = 0; a < s->size; a++) if ((s->entry[a].key != 0) && (s->entry[a].cn >= limit)) {
+      PairShardAdd(&reduced, s->entry[a].key, s->entry[a].cn);
+    }
+    free(s->entry);
+    *s = reduced;
+  }
+  if (t >= 0) min_reduce[t]++;
+}
+
+// Counts the unigrams of the input for thread t
+void *CountThread(void *id) {
+  int t = (long long)id, p;
+  char word[MAX_STRING];
+  char *pos;
+  long long words = 0, used;
+  unsigned long long mix;
+  struct text_chunk c;
+  memset(&c, 0, sizeof(c));
+  while (NextChunk(&c)) {
+    for (pos = c.data; (pos = NextWord(pos, c.data + c.size, word)) != NULL; ) {
+      if (!strcmp(word, "</s>")) continue;
+      c.words++;
+      mix = MixHash(WordHash(word));
+      ShardAdd(&shards[t * num_threads + (mix >> 32) % num_threads], word, mix, 1, 1);
+    }
+    words += c.words;
+    for (used = 0, p = 0; p < num_threads; p++) used += shards[t * num_threads + p].used;
+    if (used > max_table_entries / num_threads) ReduceShards(t);
+  }
+  free(c.data);
+  pthread_mutex_lock(&input_lock);
+  train_words += words;
+  pthread_mutex_unlock(&input_lock);
+  return NULL;
+}
+
+// Counts the bigrams of known words for thread t; bigrams do not span lines,
+// and chunks hold whole lines
+void *CountPairsThread(void *id) {
+  int t = (long long)id, p;
+  char word[MAX_STRING];
+  char *pos;
+  long long i, last, used;
+  struct text_chunk c;
+  memset(&c, 0, sizeof(c));
+  while (NextChunk(&c)) {
+    last = -1;
+    for (pos = c.data; (pos = NextWord(pos, c.data + c.size, word)) != NULL; ) {
+      if (!strcmp(word, "</s>")) {
+        last = -1;
+        continue;
+      }
+      c.words++;
+      i = SearchVocab(word);
+      if ((last != -1) && (i != -1)) {
+        AddPair(t, PairKey(last, i));
+      }
+      last = i;
+    }
+    if (sketch != NULL) continue;
+    for (used = 0, p = 0; p < num_threads; p++) used += pair_shards[t * num_threads + p].used;
+    if (used > max_table_entries / num_threads) ReducePairShards(t, min_reduce[t] + 1);
+  }
+  if (sketch != NULL) FlushPairShards(t);
+  free(c.data);
+  return NULL;
+}
+
+// Merges shard p of every thread into that of thread 0
+void *MergeThread(void *id) {
+  int p = (long long)id, t;
+  long long a;
+  struct count_shard *s, *merged = &shards[p];
+  for (t = 1; t < num_threads; t++) {
+    s = &shards[t * num_threads + p];
+    for (a = 0; a < s->size; a++) if (s->entry[a].word != NULL) {
+      ShardAdd(merged, s->entry[a].word, MixHash(WordHash(s->entry[a].word)), s->entry[a].cn, 0);
+    }
+    free(s->entry);
+  }
+  return NULL;
+}
+
+void *MergePairsThread(void *id) {
+  int p = (long long)id, t;
+  long long a;
+  struct pair_shard *s, *merged = &pair_shards[p];
+  for (t = 1; t < num_threads; t++) {
+    s = &pair_shards[t * num_threads + p];
+    for (a = 0; a < s->size; a++) if (s->entry[a].key != 0) PairShardAdd(merged, s->entry[a].key, s->entry[a].cn);
+    free(s->entry);
+  }
+  return NULL;
+}
+
+// Runs num_threads threads of 'fn', passing each its number
+void RunThreads(void *(*fn)(void *)) {
+  int t;
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  for (t = 0; t < num_threads; t++) pthread_create(&pt[t], NULL, fn, (void *)(long long)t);
+  for (t = 0; t < num_threads; t++) pthread_join(pt[t], NULL);
+  free(pt);
 }
 
 void LearnVocabFromTrainFile() {
-  char word[MAX_STRING], last_word[MAX_STRING], bigram_word[MAX_STRING * 2];
-  FILE *fin;
-  long long a, i, start = 1;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  fin = fopen(train_file, "rb");
-  if (fin == NULL) {
-    printf("ERROR: training data file not found!\n");
-    exit(1);
+  long long a, size;
+  int t, p;
+  shards = (struct count_shard *)malloc(num_threads * num_threads * sizeof(struct count_shard));
+  min_reduce = (int *)malloc(num_threads * sizeof(int));
+  for (t = 0; t < num_threads; t++) {
+    min_reduce[t] = 1;
+    for (p = 0; p < num_threads; p++) ShardInit(&shards[t * num_threads + p], 1024);
   }
-  vocab_size = 0;
-  AddWordToVocab((char *)"</s>");
-  while (1) {
-    ReadWord(word, fin);
-    if (feof(fin)) break;
-    if (!strcmp(word, "</s>")) {
-      start = 1;
-      continue;
-    } else start = 0;
-    train_words++;
-    if ((debug_mode > 1) && (train_words % 100000 == 0)) {
-      printf("Words processed: %lldK     Vocab size: %lldK  %c", train_words / 1000, vocab_size / 1000, 13);
-      fflush(stdout);
+  RewindInput("Words processed");
+  RunThreads(CountThread);
+  RunThreads(MergeThread);
+  // The merged shards become the vocabulary, after </s>
+  for (size = 1, p = 0; p < num_threads; p++) size += shards[p].used;
+  vocab = (struct vocab_word *)malloc(size * sizeof(struct vocab_word));
+  vocab[0].word = strdup("</s>");
+  vocab[0].cn = 0;
+  vocab_size = 1;
+  for (p = 0; p < num_threads; p++) {
+    for (a = 0; a < shards[p].size; a++) if (shards[p].entry[a].word != NULL) vocab[vocab_size++] = shards[p].entry[a];
+    free(shards[p].entry);
+  }
+  free(shards);
+  // The hash table is sized for the words counted, at most half full
+  vocab_hash_size = (vocab_size < 512) ? 1024 : vocab_size * 2;
+  vocab_hash = (int *)malloc(vocab_hash_size * sizeof(int));
+  // Several passes need every word, to write it out at the end
+  SortVocab((pass_count > 1) ? 0 : min_count);
+}
+
+// Prepares the shards, and with a memory budget the sketch, for counting
+// bigrams.  A quarter of the budget goes to the tables of the shards, split
+// evenly among the threads and their shards, and the rest to the sketch.
+void StartPairCounts() {
+  int t, p;
+  if (pair_shards != NULL) {
+    for (p = 0; p < num_threads; p++) free(pair_shards[p].entry);
+    free(pair_shards);
+  }
+  if ((memory_budget > 0) && (sketch == NULL)) {
+    sketch_width = memory_budget * 1048576 * 3 / 4 / (SKETCH_DEPTH * sizeof(unsigned int));
+    sketch_flush_entries = memory_budget * 1048576 / 4 / num_threads / sizeof(struct pair_entry);
+    for (sketch_shard_size = 16; sketch_shard_size * 2 * num_threads <= sketch_flush_entries; sketch_shard_size *= 2);
+    sketch = (unsigned int *)calloc(SKETCH_DEPTH * sketch_width, sizeof(unsigned int));
+    if ((sketch_width < 1) || (sketch == NULL)) {
+      printf("ERROR: can not allocate a sketch for -memory-budget %lld\n", memory_budget);
+      exit(1);
     }
-    i = SearchVocab(word);
-    if (i == -1) {
-      a = AddWordToVocab(word);
-      vocab[a].cn = 1;
-    } else vocab[i].cn++;
-    if (start) continue;
-    sprintf(bigram_word, "%s_%s", last_word, word);
-    bigram_word[MAX_STRING - 1] = 0;
-    strcpy(last_word, word);
-    i = SearchVocab(bigram_word);
-    if (i == -1) {
-      a = AddWordToVocab(bigram_word);
-      vocab[a].cn = 1;
-    } else vocab[i].cn++;
-    if (vocab_size > vocab_hash_size * 0.7) ReduceVocab();
-  }
-  SortVocab();
+  } else if (sketch != NULL) memset(sketch, 0, SKETCH_DEPTH * sketch_width * sizeof(unsigned int));
+  sketch_total = 0;
+  bigram_count = 0;
+  min_reduce = (int *)malloc(num_threads * sizeof(int));
+  pair_shards = (struct pair_shard *)malloc(num_threads * num_threads * sizeof(struct pair_shard));
+  for (t = 0; t < num_threads; t++) {
+    min_reduce[t] = 1;
+    for (p = 0; p < num_threads; p++) PairShardInit(&pair_shards[t * num_threads + p], (sketch != NULL) ? sketch_shard_size : 1024);
+  }
+}
+
+// Merges the bigram counts of the threads, keeping those seen at least
+// min_count times, and reports them
+void FinishPairCounts() {
+  int t, p;
+  free(min_reduce);
+  if (sketch != NULL) {
+    for (t = 1; t < num_threads; t++) for (p = 0; p < num_threads; p++) free(pair_shards[t * num_threads + p].entry);
+    if (debug_mode > 0) {
+      printf("\nVocab size: %lld unigrams\n", vocab_size);
+      printf("Words in train file: %lld\n", train_words);
+      printf("Bigram counts: %d x %lld count-min sketch of %lld bigrams; each count is over by at most %.1f\n",
+        SKETCH_DEPTH, sketch_width, sketch_total, exp(1) / sketch_width * sketch_total);
+      printf("with probability %.3f, so scores are over by at most %.3g x train words / (pa x pb)\n",
+        1 - exp(-SKETCH_DEPTH), exp(1) / sketch_width * sketch_total);
+    }
+    return;
+  }
+  RunThreads(MergePairsThread);
+  ReducePairShards(-1, min_count);
+  for (p = 0; p < num_threads; p++) bigram_count += pair_shards[p].used;
   if (debug_mode > 0) {
-    printf("\nVocab size (unigrams + bigrams): %lld\n", vocab_size);
+    printf("\nVocab size: %lld unigrams, %lld bigrams\n", vocab_size, bigram_count);
     printf("Words in train file: %lld\n", train_words);
   }
-  fclose(fin);
 }
 
-void TrainModel() {
-  long long pa = 0, pb = 0, pab = 0, oov, i, li = -1, cn = 0;
-  char word[MAX_STRING], last_word[MAX_STRING], bigram_word[MAX_STRING * 2];
-  real score;
-  FILE *fo, *fin;
-  printf("Starting training using file %s\n", train_file);
-  LearnVocabFromTrainFile();
-  fin = fopen(train_file, "rb");
-  fo = fopen(output_file, "wb");
-  word[0] = 0;
-  while (1) {
-    strcpy(last_word, word);
-    ReadWord(word, fin);
-    if (feof(fin)) break;
+// Decides whether the word of id i (-1 if unknown) joins the word before it,
+// of id li (-1 at the start of a line), into a phrase.  *pa is the count of
+// the word before, or 0 if that was joined itself; it is updated for the next.
+static int JoinWord(long long li, long long i, long long *pa) {
+  long long pb = (i == -1) ? 0 : vocab[i].cn, pab;
+  real score = 0;
+  if ((li != -1) && (i != -1) && (*pa >= min_count) && (pb >= min_count)) {
+    pab = PairCount(li, i);
+    if (pab > 0) score = (pab - min_count) / (real)*pa / (real)pb * (real)train_words;
+  }
+  *pa = (score > threshold) ? 0 : pb;
+  return score > threshold;
+}
+
+// A chunk of the input and the phrased text written for it
+struct phrase_chunk {
+  struct text_chunk in;
+  char *out;
+  long long out_size, out_capacity;
+  struct pair_shard joined;            // with -save-phrases, the pairs joined so far
+};
+
+// With -save-phrases, the pairs joined by each pass
+struct pair_shard joined[MAX_PASSES];
+
+// Joins the words of a chunk whose bigram scores pass the threshold
+void *PhraseThread(void *arg) {
+  struct phrase_chunk *c = (struct phrase_chunk *)arg;
+  long long pa = 0, i, li = -1;
+  char word[MAX_STRING];
+  char *pos, *out;
+  // Each word grows by at most its separator
+  if (c->out_capacity < 2 * c->in.size) {
+    c->out_capacity = 2 * c->in.size;
+    c->out = (char *)realloc(c->out, c->out_capacity);
+  }
+  out = c->out;
+  for (pos = c->in.data; (pos = NextWord(pos, c->in.data + c->in.size, word)) != NULL; ) {
     if (!strcmp(word, "</s>")) {
-      fprintf(fo, "\n");
+      *out++ = '\n';
+      li = -1;
       continue;
     }
-    cn++;
-    if ((debug_mode > 1) && (cn % 100000 == 0)) {
-      printf("Words written: %lldK%c", cn / 1000, 13);
-      fflush(stdout);
-    }
-    oov = 0;
+    c->in.words++;
     i = SearchVocab(word);
-    if (i == -1) oov = 1; else pb = vocab[i].cn;
-    if (li == -1) oov = 1;
+    if (JoinWord(li, i, &pa)) {
+      *out++ = '_';
+      if (c->joined.entry != NULL) PairShardAdd(&c->joined, PairKey(li, i), 1);
+    } else *out++ = ' ';
     li = i;
-    sprintf(bigram_word, "%s_%s", last_word, word);
-    bigram_word[MAX_STRING - 1] = 0;
-    i = SearchVocab(bigram_word);
-    if (i == -1) oov = 1; else pab = vocab[i].cn;
-    if (pa < min_count) oov = 1;
-    if (pb < min_count) oov = 1;
-    if (oov) score = 0; else score = (pab - min_count) / (real)pa / (real)pb * (real)train_words;
-    if (score > threshold) {
-      fprintf(fo, "_%s", word);
-      pb = 0;
-    } else fprintf(fo, " %s", word);
-    pa = pb;
+    strcpy(out, word);
+    out += strlen(word);
+  }
+  c->out_size = out - c->out;
+  return NULL;
+}
+
+// With several passes (-thresholds), the corpus is kept in memory as a
+// stream of word ids, 0 (</s>) marking the ends of lines.  Each pass
+// counts the words and bigrams of the stream, marks the words that join the
+// word before them by negating their ids, and then replaces each marked
+// pair by the id of its phrase.
+int *stream;
+long long stream_size = 0;
+
+// Adds a word with no count to the vocabulary, growing its hash table as
+// needed, and returns its id
+long long AddWordToVocab(char *word) {
+  long long a, hash;
+  if (vocab_size == vocab_max_size) {
+    vocab_max_size = vocab_max_size * 3 / 2 + 1024;
+    vocab = (struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
+  }
+  vocab[vocab_size].word = strdup(word);
+  vocab[vocab_size].cn = 0;
+  vocab_size++;
+  if (vocab_size * 2 > vocab_hash_size) {
+    vocab_hash_size *= 2;
+    vocab_hash = (int *)realloc(vocab_hash, vocab_hash_size * sizeof(int));
+    for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
+    for (a = 0; a < vocab_size; a++) {
+      hash = GetWordHash(vocab[a].word);
+      while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
+      vocab_hash[hash] = a;
+    }
+  } else {
+    hash = GetWordHash(word);
+    while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
+    vocab_hash[hash] = vocab_size - 1;
+  }
+  return vocab_size - 1;
+}
+
+// A chunk of the input and its word ids.  Words missing from the vocabulary
+// (those dropped by ReduceShards) are numbered 1, 2, ... in 'missing' and
+// given the ids -1, -2, ... until ReadStream adds them to the vocabulary, as
+// the threads must not change it while they look words up.
+struct id_chunk {
+  struct text_chunk in;
+  int *id;
+  long long size, capacity;
+  struct count_shard missing;          // number of each missing word, in place of its count
+};
+
+// Returns the number of a word missing from the vocabulary, within the chunk
+static long long MissingWord(struct id_chunk *c, char *word) {
+  struct count_shard *s = &c->missing;
+  unsigned long long mix = MixHash(WordHash(word));
+  long long i;
+  for (i = mix & (s->size - 1); s->entry[i].word != NULL; i = (i + 1) & (s->size - 1)) {
+    if (!strcmp(s->entry[i].word, word)) return s->entry[i].cn;
+  }
+  ShardAdd(s, word, mix, s->used + 1, 1);
+  return s->used;
+}
+
+void *ReadIdsThread(void *arg) {
+  struct id_chunk *c = (struct id_chunk *)arg;
+  char word[MAX_STRING];
+  char *pos;
+  long long i;
+  // There are fewer words than bytes
+  if (c->capacity < c->in.size) {
+    c->capacity = c->in.size;
+    c->id = (int *)realloc(c->id, c->capacity * sizeof(int));
+  }
+  c->size = 0;
+  for (pos = c->in.data; (pos = NextWord(pos, c->in.data + c->in.size, word)) != NULL; ) {
+    if (!strcmp(word, "</s>")) {
+      c->id[c->size++] = 0;
+      continue;
+    }
+    c->in.words++;
+    i = SearchVocab(word);
+    c->id[c->size++] = (i != -1) ? i : -MissingWord(c, word);
+  }
+  return NULL;
+}
+
+// Adds the missing words of a chunk to the vocabulary and gives them their ids
+void AddMissingWords(struct id_chunk *c) {
+  struct count_shard *s = &c->missing;
+  long long a, i, *ids;
+  if (s->used == 0) return;
+  ids = (long long *)malloc((s->used + 1) * sizeof(long long));
+  for (a = 0; a < s->size; a++) if (s->entry[a].word != NULL) {
+    i = SearchVocab(s->entry[a].word);
+    ids[s->entry[a].cn] = (i != -1) ? i : AddWordToVocab(s->entry[a].word);
+    free(s->entry[a].word);
+    s->entry[a].word = NULL;
+  }
+  for (a = 0; a < c->size; a++) if (c->id[a] < 0) c->id[a] = ids[-c->id[a]];
+  s->used = 0;
+  free(ids);
+}
+
+// Reads the training files into the stream, num_threads chunks at a time
+void ReadStream() {
+  int a, n;
+  long long capacity = 0;
+  struct id_chunk *chunks = (struct id_chunk *)calloc(num_threads, sizeof(struct id_chunk));
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  stream = NULL;
+  for (a = 0; a < num_threads; a++) ShardInit(&chunks[a].missing, 1024);
+  RewindInput("Words read");
+  while (1) {
+    for (n = 0; n < num_threads; n++) if (!NextChunk(&chunks[n].in)) break;
+    if (n == 0) break;
+    for (a = 0; a < n; a++) pthread_create(&pt[a], NULL, ReadIdsThread, &chunks[a]);
+    for (a = 0; a < n; a++) pthread_join(pt[a], NULL);
+    for (a = 0; a < n; a++) {
+      AddMissingWords(&chunks[a]);
+      if (stream_size + chunks[a].size > capacity) {
+        capacity = (stream_size + chunks[a].size) * 3 / 2;
+        stream = (int *)realloc(stream, capacity * sizeof(int));
+      }
+      memcpy(stream + stream_size, chunks[a].id, chunks[a].size * sizeof(int));
+      stream_size += chunks[a].size;
+    }
+    if (n < num_threads) break;
+  }
+  for (a = 0; a < num_threads; a++) {
+    free(chunks[a].in.data);
+    free(chunks[a].id);
+    free(chunks[a].missing.entry);
+  }
+  free(chunks);
+  free(pt);
+}
+
+// Returns the first position of the line holding position 'pos' of the
+// stream, so that each thread starts on a line of its own
+long long LineStart(long long pos) {
+  while ((pos > 0) && (pos < stream_size) && (stream[pos - 1] != 0)) pos++;
+  return (pos < stream_size) ? pos : stream_size;
+}
+
+// Counts the bigrams of the stream for thread t: those ending in its part
+void *CountStreamPairsThread(void *id) {
+  int t = (long long)id, p;
+  long long i, used, last = stream_size * (t + 1) / num_threads;
+  for (i = stream_size * t / num_threads; i < last; i++) {
+    if ((i == 0) || (stream[i - 1] == 0) || (stream[i] == 0)) continue;
+    if ((vocab[stream[i - 1]].cn < min_count) || (vocab[stream[i]].cn < min_count)) continue;
+    AddPair(t, PairKey(stream[i - 1], stream[i]));
+    if ((sketch == NULL) && ((i & 0xffff) == 0)) {
+      for (used = 0, p = 0; p < num_threads; p++) used += pair_shards[t * num_threads + p].used;
+      if (used > max_table_entries / num_threads) ReducePairShards(t, min_reduce[t] + 1);
+    }
+  }
+  if (sketch != NULL) FlushPairShards(t);
+  return NULL;
+}
+
+// Marks the words of the lines starting in the part of thread t that join
+// the word before them.  The parts start at line_starts[t], found before the
+// threads mark any word, as a thread must not look at the words of another.
+long long *line_starts;
+
+void *JoinStreamThread(void *id) {
+  int t = (long long)id;
+  long long i, li = -1, pa = 0;
+  for (i = line_starts[t]; i < line_starts[t + 1]; i++) {
+    if (stream[i] == 0) {
+      li = -1;
+      continue;
+    }
+    if (JoinWord(li, stream[i], &pa)) {
+      li = stream[i];
+      stream[i] = -stream[i];
+    } else li = stream[i];
+  }
+  return NULL;
+}
+
+// Replaces the pairs marked in the stream by their phrases; 'ids' is left
+// with the phrase id of each pair joined, in place of its count
+void JoinStream(struct pair_shard *ids) {
+  long long i, n = 0, id;
+  char *phrase;
+  unsigned long long key;
+  struct pair_entry *e;
+  PairShardInit(ids, 1024);
+  for (i = 0; i < stream_size; i++) {
+    if (stream[i] >= 0) {
+      stream[n++] = stream[i];
+      continue;
+    }
+    key = PairKey(stream[n - 1], -stream[i]);
+    e = PairShardFind(ids, key);
+    if (e != NULL) id = e->cn;
+    else {
+      // A phrase may already be a word of the corpus
+      phrase = (char *)malloc(strlen(vocab[stream[n - 1]].word) + strlen(vocab[-stream[i]].word) + 2);
+      sprintf(phrase, "%s_%s", vocab[stream[n - 1]].word, vocab[-stream[i]].word);
+      id = SearchVocab(phrase);
+      if (id == -1) id = AddWordToVocab(phrase);
+      PairShardAdd(ids, key, id);
+      free(phrase);
+    }
+    stream[n - 1] = id;
+  }
+  stream_size = n;
+}
+
+// Formats part t of the stream as text, into 'out'
+struct text_part {
+  long long first, last;
+  char *out;
+  long long out_size;
+};
+
+void *WriteStreamThread(void *arg) {
+  struct text_part *part = (struct text_part *)arg;
+  long long i, n = 0;
+  char *out;
+  for (i = part->first; i < part->last; i++) n += (stream[i] == 0) ? 1 : strlen(vocab[stream[i]].word) + 1;
+  out = part->out = (char *)malloc(n + 1);
+  for (i = part->first; i < part->last; i++) {
+    if (stream[i] == 0) *out++ = '\n';
+    else {
+      *out++ = ' ';
+      strcpy(out, vocab[stream[i]].word);
+      out += strlen(vocab[stream[i]].word);
+    }
+  }
+  part->out_size = out - part->out;
+  return NULL;
+}
+
+// Runs the phrase passes of -thresholds on the stream and writes the result,
+// unless fo is NULL
+void TrainPasses(FILE *fo) {
+  int a, pass;
+  long long i;
+  struct text_part *parts = (struct text_part *)calloc(num_threads, sizeof(struct text_part));
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  line_starts = (long long *)malloc((num_threads + 1) * sizeof(long long));
+  ReadStream();
+  for (pass = 0; pass < pass_count; pass++) {
+    threshold = thresholds[pass];
+    if (debug_mode > 0) printf("\nPass %d, threshold %g\n", pass + 1, threshold);
+    // The counts of the words, phrases included, as a new corpus
+    for (i = 0; i < vocab_size; i++) vocab[i].cn = 0;
+    for (i = 0; i < stream_size; i++) vocab[stream[i]].cn++;
+    train_words = stream_size - vocab[0].cn;
+    vocab[0].cn = 0;
+    StartPairCounts();
+    RunThreads(CountStreamPairsThread);
+    FinishPairCounts();
+    for (a = 0; a < num_threads; a++) line_starts[a] = LineStart(stream_size * a / num_threads);
+    line_starts[num_threads] = stream_size;
+    RunThreads(JoinStreamThread);
+    JoinStream(&joined[pass]);
+    if (!save_phrases_file[0]) free(joined[pass].entry);
+  }
+  if (fo == NULL) {
+    free(parts);
+    free(pt);
+    free(stream);
+    free(line_starts);
+    return;
+  }
+  for (a = 0; a < num_threads; a++) {
+    parts[a].first = stream_size * a / num_threads;
+    parts[a].last = stream_size * (a + 1) / num_threads;
+    pthread_create(&pt[a], NULL, WriteStreamThread, &parts[a]);
+  }
+  for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+  for (a = 0; a < num_threads; a++) {
+    fwrite(parts[a].out, 1, parts[a].out_size, fo);
+    free(parts[a].out);
+  }
+  free(parts);
+  free(pt);
+  free(stream);
+  free(line_starts);
+}
+
+// Saves the phrase table for word2vec -phrases: the number of passes and the
+// length to which ReadWord truncates the words of the input, then for each pass the number of pairs it joined and one pair per line, as the
+// two words (or phrases of the passes before) that form the phrase
+void SavePhrases() {
+  int pass;
+  long long a;
+  unsigned long long key;
+  FILE *fo = fopen(save_phrases_file, "wb");
+  if (fo == NULL) {
+    printf("ERROR: can not write %s\n", save_phrases_file);
+    exit(1);
+  }
+  fprintf(fo, "%d %d\n", pass_count, MAX_STRING - 2);
+  for (pass = 0; pass < pass_count; pass++) {
+    fprintf(fo, "%lld\n", joined[pass].used);
+    for (a = 0; a < joined[pass].size; a++) if (joined[pass].entry[a].key != 0) {
+      key = joined[pass].entry[a].key;
+      fprintf(fo, "%s %s\n", vocab[key >> 32].word, vocab[key & 0xffffffff].word);
+    }
+    free(joined[pass].entry);
   }
   fclose(fo);
-  fclose(fin);
+  if (debug_mode > 0) printf("Phrase table saved to %s\n", save_phrases_file);
+}
+
+void TrainModel() {
+  int a, n;
+  long long b;
+  FILE *fo = NULL;
+  struct phrase_chunk *chunks;
+  pthread_t *pt;
+  printf("Starting training using file %s\n", train_file);
+  ListTrainFiles(train_file);
+  LearnVocabFromTrainFile();
+  if (output_file[0]) {
+    fo = fopen(output_file, "wb");
+    if (fo == NULL) {
+      printf("ERROR: can not write %s\n", output_file);
+      exit(1);
+    }
+  }
+  if (pass_count > 1) {
+    TrainPasses(fo);
+    if (fo != NULL) fclose(fo);
+    if (save_phrases_file[0]) SavePhrases();
+    return;
+  }
+  // Second pass: the bigrams of words that are in the vocabulary; the
+  // others can not form phrases
+  StartPairCounts();
+  RewindInput("Bigrams counted in words");
+  RunThreads(CountPairsThread);
+  FinishPairCounts();
+  // Chunks are phrased num_threads at a time and written in order
+  chunks = (struct phrase_chunk *)calloc(num_threads, sizeof(struct phrase_chunk));
+  pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  if (save_phrases_file[0]) for (a = 0; a < num_threads; a++) PairShardInit(&chunks[a].joined, 1024);
+  RewindInput((fo != NULL) ? "Words written" : "Words phrased");
+  while (1) {
+    for (n = 0; n < num_threads; n++) if (!NextChunk(&chunks[n].in)) break;
+    if (n == 0) break;
+    for (a = 0; a < n; a++) pthread_create(&pt[a], NULL, PhraseThread, &chunks[a]);
+    for (a = 0; a < n; a++) pthread_join(pt[a], NULL);
+    if (fo != NULL) for (a = 0; a < n; a++) fwrite(chunks[a].out, 1, chunks[a].out_size, fo);
+    if (n < num_threads) break;
+  }
+  if (fo != NULL) fclose(fo);
+  if (save_phrases_file[0]) PairShardInit(&joined[0], 1024);
+  for (a = 0; a < num_threads; a++) {
+    free(chunks[a].in.data);
+    free(chunks[a].out);
+    if (chunks[a].joined.entry == NULL) continue;
+    for (b = 0; b < chunks[a].joined.size; b++) if (chunks[a].joined.entry[b].key != 0) {
+      PairShardAdd(&joined[0], chunks[a].joined.entry[b].key, 1);
+    }
+    free(chunks[a].joined.entry);
+  }
+  free(chunks);
+  free(pt);
+  if (save_phrases_file[0]) SavePhrases();
 }
 
 int ArgPos(char *str, int argc, char **argv) {
@@ -267,13 +1032,26 @@ int main(int argc, char **argv) {
     printf("Options:\n");
     printf("Parameters for training:\n");
     printf("\t-train <file>\n");
-    printf("\t\tUse text data from <file> to train the model\n");
+    printf("\t\tUse text data from <file> to train the model; <file> may also be a directory, a glob pattern\n");
+    printf("\t\tor @<list>, a file naming one training file per line, in which case all the files are used\n");
     printf("\t-output <file>\n");
     printf("\t\tUse <file> to save the resulting word vectors / word clusters / phrases\n");
+    printf("\t-save-phrases <file>\n");
+    printf("\t\tSave the phrase table, the word pairs joined by each pass, to <file>; word2vec -phrases then joins\n");
+    printf("\t\tthem as it reads the corpus, and -output may be left out\n");
     printf("\t-min-count <int>\n");
     printf("\t\tThis will discard words that appear less than <int> times; default is 5\n");
     printf("\t-threshold <float>\n");
     printf("\t\t The <float> value represents threshold for forming the phrases (higher means less phrases); default 100\n");
+    printf("\t-thresholds <list>\n");
+    printf("\t\tRun one pass per threshold of the comma-separated <list> (e.g. 200,100), to form longer phrases;\n");
+    printf("\t\tbetween the passes, the corpus is kept in memory, at 4 bytes per word\n");
+    printf("\t-memory-budget <int>\n");
+    printf("\t\tCount bigrams approximately, in <int> MB, with a count-min sketch; default is 0 (exact counts). The\n");
+    printf("\t\tvocabulary, the text buffers of the threads and, with -thresholds, the input held as word ids are\n");
+    printf("\t\tnot included\n");
+    printf("\t-threads <int>\n");
+    printf("\t\tUse <int> threads (default 12)\n");
     printf("\t-debug <int>\n");
     printf("\t\tSet the debug mode (default = 2 = more info during training)\n");
     printf("\nExamples:\n");
@@ -283,10 +1061,25 @@ int main(int argc, char **argv) {
   if ((i = ArgPos((char *)"-train", argc, argv)) > 0) strcpy(train_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-output", argc, argv)) > 0) strcpy(output_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-save-phrases", argc, argv)) > 0) strcpy(save_phrases_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) min_count = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-threshold", argc, argv)) > 0) threshold = atof(argv[i + 1]);
-  vocab = (struct vocab_word *)calloc(vocab_max_size, sizeof(struct vocab_word));
-  vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
+  if ((i = ArgPos((char *)"-thresholds", argc, argv)) > 0) {
+    char *list = argv[i + 1];
+    pass_count = 0;
+    while (pass_count < MAX_PASSES) {
+      thresholds[pass_count++] = strtod(list, &list);
+      if (*list++ != ',') break;
+    }
+    threshold = thresholds[0];
+  }
+  if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_threads = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-memory-budget", argc, argv)) > 0) memory_budget = atoll(argv[i + 1]);
+  if (num_threads < 1) num_threads = 1;
+  if (!output_file[0] && !save_phrases_file[0]) {
+    printf("ERROR: -output or -save-phrases is required\n");
+    return 1;
+  }
   TrainModel();
   return 0;
 }
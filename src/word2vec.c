@@ -16,8 +16,36 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include <time.h>
 #include <windows.h>
+#include <xmmintrin.h>
+#define PREFETCH(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+typedef CRITICAL_SECTION lock_t;
+typedef CONDITION_VARIABLE cond_t;
+#define LockInit(l) InitializeCriticalSection(l)
+#define Lock(l) EnterCriticalSection(l)
+#define Unlock(l) LeaveCriticalSection(l)
+#define CondInit(c) InitializeConditionVariable(c)
+#define CondWait(c, l) SleepConditionVariableCS(c, l, INFINITE)
+#define CondBroadcast(c) WakeAllConditionVariable(c)
 #else
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#define PREFETCH(p) __builtin_prefetch(p)
+typedef pthread_mutex_t lock_t;
+typedef pthread_cond_t cond_t;
+#define LockInit(l) pthread_mutex_init(l, NULL)
+#define Lock(l) pthread_mutex_lock(l)
+#define Unlock(l) pthread_mutex_unlock(l)
+#define CondInit(c) pthread_cond_init(c, NULL)
+#define CondWait(c, l) pthread_cond_wait(c, l)
+#define CondBroadcast(c) pthread_cond_broadcast(c)
 #endif
 
 #include <stdio.h>
@@ -25,11 +53,27 @@
 #include <string.h>
 #include <math.h>
 
+#include "model-format.h"
+#include "train-files.h"
+
 #define MAX_STRING 100
+#define SEGMENT_SIZE (64LL << 20)
 #define EXP_TABLE_SIZE 1000
 #define MAX_EXP 6
 #define MAX_SENTENCE_LENGTH 1000
 #define MAX_CODE_LENGTH 40
+#define READ_BUFFER_SIZE (1 << 20)
+#define HS_TOP_LEVELS 8
+#define NEG_LANES 4
+#define ROW_LANES 16
+
+// The training threads' linear congruential generator; NEG_LCG_MUL/ADD step it
+// NEG_LANES positions at once, so NEG_LANES interleaved lanes can be advanced
+// independently while together producing the same sequence as one stream
+#define LCG_MUL 25214903917ULL
+#define LCG_ADD 11ULL
+#define NEG_LCG_MUL (LCG_MUL * LCG_MUL * LCG_MUL * LCG_MUL)
+#define NEG_LCG_ADD (LCG_ADD * (LCG_MUL * LCG_MUL * LCG_MUL + LCG_MUL * LCG_MUL + LCG_MUL + 1))
 
 #define STRINGIZE(x) STRINGIZE2(x)
 #define STRINGIZE2(x) #x
@@ -44,18 +88,27 @@ typedef unsigned char bool;
 const bool true = 1;
 const bool false = 0;
 
-struct vocab_word {
-  long count;
-  int *point;
-  char *word, *code, codelen;
-};
-
-char train_file[MAX_STRING], output_file[MAX_STRING];
+char train_file[MAX_PATH_STRING], output_file[MAX_STRING];
 char save_vocab_file[MAX_STRING], read_vocab_file[MAX_STRING];
-struct vocab_word *vocab;
+
+// The vocabulary is kept as a set of dense arrays indexed by word id, rather
+// than an array of per-word structs.  Word strings are packed end to end in a
+// single arena, and Huffman codes/points for all words are stored in flat
+// arrays, with word a's entries at [vocab_code_start[a], vocab_code_start[a + 1]).
+char *vocab_arena;                     // all word strings, each NUL-terminated
+long long vocab_arena_size = 0, vocab_arena_max_size = 0;
+long long *vocab_word_pos;             // offset of each word's string in vocab_arena
+long long *vocab_count;                // number of occurrences of each word
+unsigned int *vocab_keep;              // subsampling keep threshold of each word, out of 65536
+char *vocab_codelen;                   // Huffman code length of each word
+long long *vocab_code_start;           // offset of each word's code/point entries
+char *vocab_code;                      // Huffman codes of all words
+int *vocab_point;                      // Huffman paths (inner node ids) of all words
 int binary = 0, cbow = 1, debug_mode = 2, window = 5, min_count = 5, num_threads = 12, min_reduce = 1;
 bool optPin = false;
 int pinRepeats = 1;
+unsigned int pinDims = ~0u;            // bit d set: dimension d may be pinned
+char pinDataFile[MAX_STRING];          // blackbox CSV of extra values to pin, if any
 
 int *vocab_hash;
 long long vocab_max_size = 1000, vocab_size = 0, layer1_size = 100;
@@ -65,23 +118,56 @@ real *syn0, *syn1, *syn1neg, *expTable;
 real *pins;			// array parallel to syn0, with 1 for free-to-change values, and 0 for pinned values
 clock_t start;
 
+// Several models can be trained from the same token stream (-models).  They
+// share the vocabulary and all the hyperparameters except the pinning options
+// and each has its own weights and output file.  The globals above
+// (output_file, optPin, pinRepeats, pinDims, pinDataFile, syn0, syn1, syn1neg,
+// pins) always describe the current model; see SelectModel().
+//
+// With -branch-iter K, the models start from a shared warm start instead: a
+// single unpinned base model is trained for the first K iterations, and each
+// model is then forked from it (its weights copied and its own pins applied)
+// for the remaining iterations.
+#define MAX_MODELS 32
+
+struct model {
+  char output_file[MAX_STRING];
+  bool pin;
+  int pin_repeats;
+  unsigned int pin_dims;
+  char pin_data[MAX_STRING];
+  real *syn0, *syn1, *syn1neg, *pins;
+};
+struct model models[MAX_MODELS];
+int model_count = 0;
+char models_file[MAX_STRING];
+long long branch_iter = 0;
+char sweep_file[MAX_STRING], sweep_stats_file[MAX_STRING + 8];
+
 int hs = 0, negative = 5;
+
+// Distributed training: the rows of syn0 and syn1neg are split among
+// ps_shard_count server processes (row r lives on server r % ps_shard_count),
+// and ps_worker_count worker processes each train on their share of the data
+char ps_serve_addr[MAX_STRING], ps_server_list[MAX_PATH_STRING];
+int ps_shard = 0, ps_shard_count = 1, ps_worker = 0, ps_worker_count = 1;
 const int table_size = 1e8;
-int *table;
+int *table = NULL;
+long long hot_rows = 0, hot_merge = 10000;  // see struct hot_cache
 
 void InitUnigramTable() {
   int a, i;
   double train_words_pow = 0;
   double d1, power = 0.75;
   table = (int *)malloc(table_size * sizeof(int));
-  for (a = 0; a < vocab_size; a++) train_words_pow += pow(vocab[a].count, power);
+  for (a = 0; a < vocab_size; a++) train_words_pow += pow(vocab_count[a], power);
   i = 0;
-  d1 = pow(vocab[i].count, power) / train_words_pow;
+  d1 = pow(vocab_count[i], power) / train_words_pow;
   for (a = 0; a < table_size; a++) {
     table[a] = i;
     if (a / (double)table_size > d1) {
       i++;
-      d1 += pow(vocab[i].count, power) / train_words_pow;
+      d1 += pow(vocab_count[i], power) / train_words_pow;
     }
     if (i >= vocab_size) i = vocab_size - 1;
   }
@@ -110,6 +196,294 @@ void ReadWord(char *word, FILE *fin) {
   word[a] = 0;
 }
 
+// Phrase table (-phrases), as saved by word2phrase -save-phrases: for each of
+// its passes, the pairs of tokens that it joined into phrases.  The reader
+// joins them again as it goes, so that the phrased corpus need not be written
+// out.  Each pass is an open addressing hash of its pairs, which are kept as
+// "first\0second\0" strings in a single pool.
+#define MAX_PHRASE_PASSES 16
+
+struct phrase_pass {
+  long long size;                      // a power of two
+  long long *slot;                     // offset + 1 of each pair in phrase_pool, 0 for free slots
+};
+struct phrase_pass phrase_passes[MAX_PHRASE_PASSES];
+int phrase_pass_count = 0;
+int phrase_token_length = MAX_STRING - 2;   // longest raw token, as word2phrase truncates them
+char *phrase_pool = NULL;
+long long phrase_pool_size = 0;
+unsigned long long phrase_table_hash = 0;   // tells phrase tables apart in the vocabulary cache
+char phrases_file[MAX_PATH_STRING];
+
+static inline unsigned long long PhraseHash(const char *first, const char *second) {
+  unsigned long long hash = 0;
+  while (*first) hash = hash * 257 + (unsigned char)*first++;
+  hash = hash * 257;
+  while (*second) hash = hash * 257 + (unsigned char)*second++;
+  hash *= 0x9E3779B97F4A7C15ULL;
+  return hash ^ (hash >> 29);
+}
+
+// Reads the phrase table.  word2phrase may truncate the tokens of its input
+// more than ReadWord does; the table records to what length, and the reader
+// then truncates them the same way, so that the same pairs are joined.
+void ReadPhraseTable() {
+  char first[MAX_STRING], second[MAX_STRING];
+  long long a, n, i, length, pairs = 0;
+  struct phrase_pass *pass;
+  FILE *fin = fopen(phrases_file, "rb");
+  if (fin == NULL) {
+    printf("ERROR: phrase table not found: %s\n", phrases_file);
+    exit(1);
+  }
+  if ((fscanf(fin, "%d %d ", &phrase_pass_count, &phrase_token_length) != 2) || (phrase_pass_count < 0)
+      || (phrase_pass_count > MAX_PHRASE_PASSES) || (phrase_token_length < 1)) {
+    printf("ERROR: %s is not a phrase table\n", phrases_file);
+    exit(1);
+  }
+  if (phrase_token_length > MAX_STRING - 2) phrase_token_length = MAX_STRING - 2;
+  phrase_table_hash = phrase_token_length;
+  for (pass = phrase_passes; pass < phrase_passes + phrase_pass_count; pass++) {
+    if ((fscanf(fin, "%lld ", &n) != 1) || (n < 0)) {
+      printf("ERROR: phrase table %s is truncated\n", phrases_file);
+      exit(1);
+    }
+    for (pass->size = 2; pass->size < 2 * n; pass->size *= 2);
+    pass->slot = (long long *)calloc(pass->size, sizeof(long long));
+    for (a = 0; a < n; a++) {
+      ReadWord(first, fin);
+      ReadWord(second, fin);
+      if (!first[0] || !second[0] || !strcmp(first, "</s>") || !strcmp(second, "</s>")) {
+        printf("ERROR: phrase table %s is truncated\n", phrases_file);
+        exit(1);
+      }
+      fscanf(fin, " ");
+      length = strlen(first) + strlen(second) + 2;
+      phrase_pool = (char *)realloc(phrase_pool, phrase_pool_size + length);
+      strcpy(phrase_pool + phrase_pool_size, first);
+      strcpy(phrase_pool + phrase_pool_size + strlen(first) + 1, second);
+      for (i = PhraseHash(first, second) & (pass->size - 1); pass->slot[i] != 0; i = (i + 1) & (pass->size - 1));
+      pass->slot[i] = phrase_pool_size + 1;
+      phrase_pool_size += length;
+      phrase_table_hash = phrase_table_hash * 0x9E3779B97F4A7C15ULL + PhraseHash(first, second);
+    }
+    phrase_table_hash = phrase_table_hash * 0x9E3779B97F4A7C15ULL + n;
+    pairs += n;
+  }
+  fclose(fin);
+  if (debug_mode > 0) printf("Phrase table: %lld pairs in %d passes\n", pairs, phrase_pass_count);
+}
+
+// Joins 'second' to 'word', as word_second, if the pair is in the given pass
+// of the phrase table; returns whether it was joined
+static bool JoinPhrase(const struct phrase_pass *pass, char *word, const char *second) {
+  long long i, length;
+  const char *pair;
+  for (i = PhraseHash(word, second) & (pass->size - 1); pass->slot[i] != 0; i = (i + 1) & (pass->size - 1)) {
+    pair = phrase_pool + pass->slot[i] - 1;
+    if (strcmp(pair, word) || strcmp(pair + strlen(pair) + 1, second)) continue;
+    length = strlen(word);
+    if (length < MAX_STRING - 2) word[length++] = '_';
+    while (*second && (length < MAX_STRING - 2)) word[length++] = *second++;
+    word[length] = 0;
+    return true;
+  }
+  return false;
+}
+
+// The token held back by one pass of the phrase table while the reader looks
+// at the token after it
+struct phrase_stage {
+  char word[MAX_STRING];
+  long long start;                     // file offset of the token
+  bool pending;
+};
+
+// Buffered reader for the training file, much cheaper per character than
+// fgetc (which also takes the stream lock every call)
+struct corpus_reader {
+  FILE *fin;
+  char *buf;
+  long long pos, len;
+  long long base;                      // file offset of buf[0]
+  long long word_start;                // file offset of the last word read
+  long long end;                       // no phrase is joined across this offset (-1: none)
+  struct phrase_stage *stage;          // one per pass of the phrase table
+};
+
+bool ReaderOpen(struct corpus_reader *r, const char *file_name) {
+  r->fin = fopen(file_name, "rb");
+  if (r->fin == NULL) return false;
+  r->buf = (char *)malloc(READ_BUFFER_SIZE);
+  r->pos = r->len = r->base = 0;
+  r->end = -1;
+  r->stage = (struct phrase_stage *)calloc(phrase_pass_count, sizeof(struct phrase_stage));
+  return true;
+}
+
+void ReaderClose(struct corpus_reader *r) {
+  fclose(r->fin);
+  free(r->buf);
+  free(r->stage);
+}
+
+static inline int ReaderGetc(struct corpus_reader *r) {
+  if (r->pos >= r->len) {
+    r->base += r->len;
+    r->len = fread(r->buf, 1, READ_BUFFER_SIZE, r->fin);
+    r->pos = 0;
+    if (r->len <= 0) return EOF;
+  }
+  return (unsigned char)r->buf[r->pos++];
+}
+
+// Reads a single word, with the same rules as ReadWord; returns false at the
+// end of the file
+bool ReaderReadRawWord(char *word, struct corpus_reader *r) {
+  int a = 0, ch;
+  while ((ch = ReaderGetc(r)) != EOF) {
+    if (ch == 13) continue;
+    if ((ch == ' ') || (ch == '\t') || (ch == '\n')) {
+      if (a > 0) {
+        if (ch == '\n') r->pos--;    // leave the newline to be read next
+        break;
+      }
+      if (ch == '\n') {
+        r->word_start = r->base + r->pos - 1;
+        strcpy(word, (char *)"</s>");
+        return true;
+      } else continue;
+    }
+    if (a == 0) r->word_start = r->base + r->pos - 1;
+    word[a] = ch;
+    a++;
+    if (a > phrase_token_length) a--;   // Truncate too long words
+  }
+  word[a] = 0;
+  return a > 0;
+}
+
+// Reads the next token as left by the first 'pass' passes of the phrase
+// table.  As in word2phrase, a pair is joined unless its first token was
+// itself joined to the one before it in the same pass.
+bool ReaderReadPhrase(char *word, struct corpus_reader *r, int pass) {
+  struct phrase_stage *s;
+  long long start;
+  if (pass == 0) return ReaderReadRawWord(word, r);
+  s = &r->stage[pass - 1];
+  if (!s->pending) {
+    if (!ReaderReadPhrase(s->word, r, pass - 1)) return false;
+    s->start = r->word_start;
+  }
+  strcpy(word, s->word);
+  start = s->start;
+  s->pending = false;
+  if (strcmp(word, "</s>") && ReaderReadPhrase(s->word, r, pass - 1)) {
+    s->start = r->word_start;
+    s->pending = strcmp(s->word, "</s>") == 0 || ((r->end >= 0) && (s->start >= r->end))
+      || !JoinPhrase(&phrase_passes[pass - 1], word, s->word);
+  }
+  r->word_start = start;
+  return true;
+}
+
+// Reads a single token of the training data, with the phrases of the phrase
+// table joined; returns false at the end of the file
+bool ReaderReadWord(char *word, struct corpus_reader *r) {
+  return ReaderReadPhrase(word, r, phrase_pass_count);
+}
+
+// For training, the files are cut into segments of at most SEGMENT_SIZE
+// bytes (smaller if that is needed to make at least min_segments of them),
+// which the reader threads take one at a time.
+long long segment_size = SEGMENT_SIZE, min_segments = 1;
+
+struct corpus_segment {
+  int file;
+  long long start, end;                // byte range; words starting in it belong to it
+};
+struct corpus_segment *segments;
+long long segment_count = 0;
+
+// Cuts the training files into segments
+void SegmentTrainFiles() {
+  long long a, start;
+  start = TrainFileSize();
+  segment_size = SEGMENT_SIZE;
+  if (start / min_segments < segment_size) segment_size = start / min_segments + 1;
+  segment_count = 0;
+  for (a = 0; a < train_file_count; a++) segment_count += train_file_sizes[a] / segment_size + 1;
+  segments = (struct corpus_segment *)calloc(segment_count, sizeof(struct corpus_segment));
+  segment_count = 0;
+  for (a = 0; a < train_file_count; a++) {
+    for (start = 0; (start == 0) || (start < train_file_sizes[a]); start += segment_size) {
+      segments[segment_count].file = a;
+      segments[segment_count].start = start;
+      segments[segment_count].end = start + segment_size;
+      if (segments[segment_count].end > train_file_sizes[a]) segments[segment_count].end = train_file_sizes[a];
+      segment_count++;
+    }
+  }
+}
+
+#define TRAIN_FILE_SAMPLE 65536
+
+static unsigned long long HashBytes(unsigned long long hash, const void *data, long long size) {
+  const unsigned char *p = (const unsigned char *)data;
+  while (size-- > 0) hash = (hash ^ *p++) * 0x100000001B3ULL;
+  return hash;
+}
+
+// Returns a hash identifying the training files: their paths, sizes and
+// modification times, and the first and last TRAIN_FILE_SAMPLE bytes of each
+unsigned long long TrainFilesHash() {
+  unsigned long long hash = 0xCBF29CE484222325ULL;
+  char *buf = (char *)malloc(TRAIN_FILE_SAMPLE);
+  long long a, n;
+  FILE *fin;
+#ifndef _MSC_VER
+  struct stat st;
+#endif
+  for (a = 0; a < train_file_count; a++) {
+    hash = HashBytes(hash, train_files[a], strlen(train_files[a]) + 1);
+    hash = HashBytes(hash, &train_file_sizes[a], sizeof(long long));
+#ifndef _MSC_VER
+    if (stat(train_files[a], &st) == 0) hash = HashBytes(hash, &st.st_mtime, sizeof(st.st_mtime));
+#endif
+    fin = fopen(train_files[a], "rb");
+    if (fin == NULL) continue;
+    n = fread(buf, 1, TRAIN_FILE_SAMPLE, fin);
+    hash = HashBytes(hash, buf, n);
+    if (train_file_sizes[a] > TRAIN_FILE_SAMPLE) {
+      fseek(fin, -TRAIN_FILE_SAMPLE, SEEK_END);
+      n = fread(buf, 1, TRAIN_FILE_SAMPLE, fin);
+      hash = HashBytes(hash, buf, n);
+    }
+    fclose(fin);
+  }
+  free(buf);
+  return hash;
+}
+
+// Opens a reader on the given segment, positioned at the first word that
+// starts inside it
+bool ReaderOpenSegment(struct corpus_reader *r, const struct corpus_segment *seg) {
+  int ch;
+  if (!ReaderOpen(r, train_files[seg->file])) return false;
+  r->end = seg->end;
+  if (seg->start > 0) {
+    // A word that straddles the segment start belongs to the previous segment
+    fseek(r->fin, seg->start - 1, SEEK_SET);
+    r->base = seg->start - 1;
+    ch = ReaderGetc(r);
+    if ((ch != ' ') && (ch != '\t') && (ch != '\n')) {
+      while (((ch = ReaderGetc(r)) != EOF) && (ch != ' ') && (ch != '\t') && (ch != '\n'));
+      if (ch != EOF) r->pos--;
+    }
+  }
+  return true;
+}
+
 // Returns hash value of a word
 int GetWordHash(const char *word) {
   unsigned long long a, hash = 0;
@@ -118,12 +492,17 @@ int GetWordHash(const char *word) {
   return hash;
 }
 
+// Returns the string of the given vocabulary word
+static inline char *VocabWord(long long a) {
+  return vocab_arena + vocab_word_pos[a];
+}
+
 // Returns position of a word in the vocabulary; if the word is not found, returns -1
 int SearchVocab(const char *word) {
   unsigned int hash = GetWordHash(word);
   while (1) {
     if (vocab_hash[hash] == -1) return -1;
-    if (!strcmp(word, vocab[vocab_hash[hash]].word)) return vocab_hash[hash];
+    if (!strcmp(word, VocabWord(vocab_hash[hash]))) return vocab_hash[hash];
     hash = (hash + 1) % vocab_hash_size;
   }
   return -1;
@@ -141,14 +520,23 @@ int ReadWordIndex(FILE *fin) {
 int AddWordToVocab(char *word) {
   unsigned int hash, length = strlen(word) + 1;
   if (length > MAX_STRING) length = MAX_STRING;
-  vocab[vocab_size].word = (char *)calloc(length, sizeof(char));
-  strcpy(vocab[vocab_size].word, word);
-  vocab[vocab_size].count = 0;
+  // Grow the string arena geometrically, so that building a large vocabulary
+  // costs a handful of reallocations rather than one allocation per word
+  if (vocab_arena_size + length > vocab_arena_max_size) {
+    vocab_arena_max_size = (vocab_arena_max_size + length) * 2;
+    vocab_arena = (char *)realloc(vocab_arena, vocab_arena_max_size);
+  }
+  vocab_word_pos[vocab_size] = vocab_arena_size;
+  memcpy(vocab_arena + vocab_arena_size, word, length - 1);
+  vocab_arena[vocab_arena_size + length - 1] = 0;
+  vocab_arena_size += length;
+  vocab_count[vocab_size] = 0;
   vocab_size++;
   // Reallocate memory if needed
   if (vocab_size + 2 >= vocab_max_size) {
-    vocab_max_size += 1000;
-    vocab = (struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
+    vocab_max_size *= 2;
+    vocab_word_pos = (long long *)realloc(vocab_word_pos, vocab_max_size * sizeof(long long));
+    vocab_count = (long long *)realloc(vocab_count, vocab_max_size * sizeof(long long));
   }
   hash = GetWordHash(word);
   while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
@@ -156,62 +544,151 @@ int AddWordToVocab(char *word) {
   return vocab_size - 1;
 }
 
-// Used later for sorting by word counts
+// Used later for sorting word ids by word counts
 int VocabCompare(const void *a, const void *b) {
-    return ((struct vocab_word *)b)->count - ((struct vocab_word *)a)->count;
+  long long ca = vocab_count[*(const int *)a], cb = vocab_count[*(const int *)b];
+  return (cb > ca) - (cb < ca);
 }
 
-// Sorts the vocabulary by frequency using word counts
-void SortVocab() {
-  int a, size;
+// Rebuilds the vocabulary arrays from the ids in 'order', keeping only those
+// whose count is at least 'keep_count' (id 0, </s>, is always kept).  The
+// string arena is repacked in the new order and the hash is re-computed.
+void RepackVocab(const int *order, long long n, long long keep_count) {
+  long long a, size = 0, arena_size = 0;
   unsigned int hash;
-  // Sort the vocabulary and keep </s> at the first position
-  qsort(&vocab[1], vocab_size - 1, sizeof(struct vocab_word), VocabCompare);
+  char *arena = (char *)malloc(vocab_arena_size > 0 ? vocab_arena_size : 1);
+  long long *word_pos = (long long *)malloc(vocab_max_size * sizeof(long long));
+  long long *count = (long long *)malloc(vocab_max_size * sizeof(long long));
   for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  size = vocab_size;
-  train_words = 0;
-  for (a = 0; a < size; a++) {
-    // Words occuring less than min_count times will be discarded from the vocab
-    if ((vocab[a].count < min_count) && (a != 0)) {
-      vocab_size--;
-      free(vocab[a].word);
-    } else {
-      // Hash will be re-computed, as after the sorting it is not actual
-      hash=GetWordHash(vocab[a].word);
-      while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-      vocab_hash[hash] = a;
-      train_words += vocab[a].count;
-    }
+  for (a = 0; a < n; a++) {
+    int w = order[a];
+    if ((vocab_count[w] < keep_count) && (w != 0)) continue;
+    long long length = strlen(VocabWord(w)) + 1;
+    memcpy(arena + arena_size, VocabWord(w), length);
+    word_pos[size] = arena_size;
+    count[size] = vocab_count[w];
+    arena_size += length;
+    hash = GetWordHash(arena + word_pos[size]);
+    while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
+    vocab_hash[hash] = size;
+    size++;
   }
-  vocab = (struct vocab_word *)realloc(vocab, (vocab_size + 1) * sizeof(struct vocab_word));
-  // Allocate memory for the binary tree construction
+  free(vocab_arena);
+  free(vocab_word_pos);
+  free(vocab_count);
+  vocab_arena = arena;
+  vocab_arena_size = vocab_arena_max_size = arena_size;
+  vocab_word_pos = word_pos;
+  vocab_count = count;
+  vocab_size = size;
+}
+
+// Precomputes the subsampling threshold of each word as an integer, so that
+// a word is discarded when a random 16-bit number exceeds its threshold
+void InitSubsampling() {
+  static unsigned int *keep = NULL;
+  long long a;
+  keep = (unsigned int *)realloc(keep, (vocab_size + 1) * sizeof(unsigned int));
   for (a = 0; a < vocab_size; a++) {
-    vocab[a].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
-    vocab[a].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
+    real ran = 1;
+    if (sample > 0) ran = (sqrt(vocab_count[a] / (sample * train_words)) + 1) * (sample * train_words) / vocab_count[a];
+    keep[a] = (ran >= 1) ? 65536 : (unsigned int)(ran * 65536);
   }
+  keep[vocab_size] = 0;
+  vocab_keep = keep;
+}
+
+// Sorts the vocabulary by frequency using word counts
+void SortVocab() {
+  long long a;
+  int *order = (int *)malloc(vocab_size * sizeof(int));
+  for (a = 0; a < vocab_size; a++) order[a] = a;
+  // Sort the vocabulary and keep </s> at the first position
+  qsort(&order[1], vocab_size - 1, sizeof(int), VocabCompare);
+  // Words occuring less than min_count times will be discarded from the vocab
+  RepackVocab(order, vocab_size, min_count);
+  free(order);
+  train_words = 0;
+  for (a = 0; a < vocab_size; a++) train_words += vocab_count[a];
+  // Allocate memory for the binary tree construction; the codes and points
+  // themselves are allocated by CreateBinaryTree once their total size is known
+  vocab_codelen = (char *)calloc(vocab_size + 1, sizeof(char));
+  vocab_code_start = (long long *)calloc(vocab_size + 1, sizeof(long long));
+  InitSubsampling();
 }
 
 // Reduces the vocabulary by removing infrequent tokens
 void ReduceVocab() {
-  int a, b = 0;
-  unsigned int hash;
-  for (a = 0; a < vocab_size; a++) if (vocab[a].count > min_reduce) {
-    vocab[b].count = vocab[a].count;
-    vocab[b].word = vocab[a].word;
-    b++;
-  } else free(vocab[a].word);
-  vocab_size = b;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  for (a = 0; a < vocab_size; a++) {
-    // Hash will be re-computed, as it is not actual
-    hash = GetWordHash(vocab[a].word);
-    while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-    vocab_hash[hash] = a;
-  }
+  long long a;
+  int *order = (int *)malloc(vocab_size * sizeof(int));
+  for (a = 0; a < vocab_size; a++) order[a] = a;
+  RepackVocab(order, vocab_size, min_reduce + 1);
+  free(order);
   fflush(stdout);
   min_reduce++;
 }
 
+// Computes a cache-friendly numbering for the inner nodes of the Huffman tree,
+// which index rows of syn1.  Every word's path starts at the root, so the top
+// HS_TOP_LEVELS levels are numbered first in breadth-first order, where they
+// form one small block that stays cache-resident.  Each subtree below that is
+// then numbered in preorder, visiting the more frequent child first, so that
+// consecutive nodes along a (frequent) path are adjacent in memory.
+// Returns an array mapping construction-order node ids (0 .. vocab_size - 2)
+// to their new ids, or NULL if the tree has no inner node.
+int *LayoutBinaryTree(const long long *count, const long long *binary, const long long *parent_node) {
+  long long a, n, head = 0, tail = 0, top = 0, next_id = 0;
+  long long inner = vocab_size - 1;
+  long long *child, *queue, *depth;
+  int *remap;
+  if (inner <= 0) return NULL;
+  child = (long long *)malloc(inner * 2 * sizeof(long long));
+  queue = (long long *)malloc((inner + 1) * sizeof(long long));
+  depth = (long long *)calloc(inner, sizeof(long long));
+  remap = (int *)malloc(inner * sizeof(int));
+  for (a = 0; a < inner * 2; a++) child[a] = -1;
+  for (a = 0; a < vocab_size * 2 - 2; a++) {
+    child[(parent_node[a] - vocab_size) * 2 + binary[a]] = a;
+  }
+  // Breadth-first over the top levels; nodes at depth HS_TOP_LEVELS are left
+  // in the queue as the roots of the subtrees laid out below
+  queue[tail++] = inner - 1;
+  while (head < tail) {
+    n = queue[head];
+    if (depth[n] >= HS_TOP_LEVELS) break;
+    head++;
+    remap[n] = next_id++;
+    for (a = 0; a < 2; a++) if (child[n * 2 + a] >= vocab_size) {
+      queue[tail] = child[n * 2 + a] - vocab_size;
+      depth[queue[tail]] = depth[n] + 1;
+      tail++;
+    }
+  }
+  // Heavy-first preorder of each remaining subtree, using the tail of the
+  // queue array as a stack
+  for (; head < tail; head++) {
+    long long *stack = queue + tail;
+    stack[top++] = queue[head];
+    while (top > 0) {
+      long long heavy, light;
+      n = stack[--top];
+      remap[n] = next_id++;
+      heavy = child[n * 2];
+      light = child[n * 2 + 1];
+      if (count[light] > count[heavy]) {
+        heavy = child[n * 2 + 1];
+        light = child[n * 2];
+      }
+      if (light >= vocab_size) stack[top++] = light - vocab_size;
+      if (heavy >= vocab_size) stack[top++] = heavy - vocab_size;
+    }
+  }
+  free(child);
+  free(queue);
+  free(depth);
+  return remap;
+}
+
 // Create binary Huffman tree using the word counts
 // Frequent words will have short unique binary codes
 void CreateBinaryTree() {
@@ -220,7 +697,8 @@ void CreateBinaryTree() {
   long long *count = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
   long long *binary = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
   long long *parent_node = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
-  for (a = 0; a < vocab_size; a++) count[a] = vocab[a].count;
+  int *remap;
+  for (a = 0; a < vocab_size; a++) count[a] = vocab_count[a];
   for (a = vocab_size; a < vocab_size * 2; a++) count[a] = 1e15;
   pos1 = vocab_size - 1;
   pos2 = vocab_size;
@@ -256,8 +734,26 @@ void CreateBinaryTree() {
     parent_node[min2i] = vocab_size + a;
     binary[min2i] = 1;
   }
+  // Measure the code length of each word, so that all codes and points can be
+  // stored contiguously
+  for (a = 0; a < vocab_size; a++) {
+    b = a;
+    i = 0;
+    while (1) {
+      i++;
+      b = parent_node[b];
+      if (b == vocab_size * 2 - 2) break;
+    }
+    vocab_codelen[a] = i;
+    vocab_code_start[a + 1] = vocab_code_start[a] + i;
+  }
+  vocab_code = (char *)calloc(vocab_code_start[vocab_size], sizeof(char));
+  vocab_point = (int *)calloc(vocab_code_start[vocab_size], sizeof(int));
+  remap = LayoutBinaryTree(count, binary, parent_node);
   // Now assign binary code to each vocabulary word
   for (a = 0; a < vocab_size; a++) {
+    char *word_code = vocab_code + vocab_code_start[a];
+    int *word_point = vocab_point + vocab_code_start[a];
     b = a;
     i = 0;
     while (1) {
@@ -267,58 +763,61 @@ void CreateBinaryTree() {
       b = parent_node[b];
       if (b == vocab_size * 2 - 2) break;
     }
-    vocab[a].codelen = i;
-    vocab[a].point[0] = vocab_size - 2;
+    // With </s> alone in the vocabulary there is no inner node to point to,
+    // and the one row of syn1 stands in for it
+    word_point[0] = (remap != NULL) ? remap[vocab_size - 2] : 0;
     for (b = 0; b < i; b++) {
-      vocab[a].code[i - b - 1] = code[b];
-      vocab[a].point[i - b] = point[b] - vocab_size;
+      word_code[i - b - 1] = code[b];
+      // (the point one past the last code bit is the word's own leaf, not an inner node)
+      if (b > 0) word_point[i - b] = remap[point[b] - vocab_size];
     }
   }
   free(count);
   free(binary);
   free(parent_node);
+  free(remap);
 }
 
 void LearnVocabFromTrainFile() {
   char word[MAX_STRING];
-  FILE *fin;
+  struct corpus_reader reader;
   long long a, i;
+  int file;
   for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  fin = fopen(train_file, "rb");
-  if (fin == NULL) {
-    printf("ERROR: training data file not found!\n");
-    exit(1);
-  }
   vocab_size = 0;
   AddWordToVocab((char *)"</s>");
-  while (1) {
-    ReadWord(word, fin);
-    if (feof(fin)) break;
-    train_words++;
-    if ((debug_mode > 1) && (train_words % 100000 == 0)) {
-      printf("%lldK%c", train_words / 1000, 13);
-      fflush(stdout);
+  for (file = 0; file < train_file_count; file++) {
+    if (!ReaderOpen(&reader, train_files[file])) {
+      printf("ERROR: training data file not found: %s\n", train_files[file]);
+      exit(1);
     }
-    i = SearchVocab(word);
-    if (i == -1) {
-      a = AddWordToVocab(word);
-      vocab[a].count = 1;
-    } else vocab[i].count++;
-    if (vocab_size > vocab_hash_size * 0.7) ReduceVocab();
+    while (ReaderReadWord(word, &reader)) {
+      train_words++;
+      if ((debug_mode > 1) && (train_words % 100000 == 0)) {
+        printf("%lldK%c", train_words / 1000, 13);
+        fflush(stdout);
+      }
+      i = SearchVocab(word);
+      if (i == -1) {
+        a = AddWordToVocab(word);
+        vocab_count[a] = 1;
+      } else vocab_count[i]++;
+      if (vocab_size > vocab_hash_size * 0.7) ReduceVocab();
+    }
+    ReaderClose(&reader);
   }
   SortVocab();
   if (debug_mode > 0) {
     printf("Vocab size: %lld\n", vocab_size);
     printf("Words in train file: %lld\n", train_words);
   }
-  file_size = ftell(fin);
-  fclose(fin);
+  file_size = TrainFileSize();
 }
 
 void SaveVocab() {
   long long i;
   FILE *fo = fopen(save_vocab_file, "wb");
-  for (i = 0; i < vocab_size; i++) fprintf(fo, "%s %ld\n", vocab[i].word, vocab[i].count);
+  for (i = 0; i < vocab_size; i++) fprintf(fo, "%s %lld\n", VocabWord(i), vocab_count[i]);
   fclose(fo);
 }
 
@@ -337,10 +836,9 @@ void ReadVocab() {
     ReadWord(word, fin);
     if (feof(fin)) break;
     a = AddWordToVocab(word);
-    // JJS: How does this work?  We wrote out (in SaveVocab) the word followed by the count.
-    // But here we seem to be reading them in the opposite order.  I'm not sure this
-    // is not a bug.
-    fscanf(fin, "%ld%c", &vocab[a].count, &c);
+    // ReadWord has consumed the word; this reads the count that follows it
+    // (as written by SaveVocab), along with the newline that ends the line.
+    fscanf(fin, "%lld%c", &vocab_count[a], &c);
     i++;
   }
   SortVocab();
@@ -348,14 +846,368 @@ void ReadVocab() {
     printf("Vocab size: %lld\n", vocab_size);
     printf("Words in train file: %lld\n", train_words);
   }
-  fin = fopen(train_file, "rb");
-  if (fin == NULL) {
-    printf("ERROR: training data file not found!\n");
-    exit(1);
+  file_size = TrainFileSize();
+}
+
+// Binary vocabulary cache.  The file holds everything derived from the
+// vocabulary that training needs (sorted words, counts, subsampling
+// thresholds, Huffman codes/points and, if built, the unigram table), laid
+// out so that it can be mapped straight into memory.  Each section starts on
+// a VOCAB_CACHE_ALIGN boundary; its offset is given in the header.
+#define VOCAB_CACHE_MAGIC "W2VVOCAB"
+#define VOCAB_CACHE_VERSION 4
+#define VOCAB_CACHE_ALIGN MODEL_FILE_ALIGN  // -binary 2 files are written the same way
+
+struct vocab_cache_header {
+  char magic[8];
+  int version, min_count;
+  real sample;
+  int table_size;
+  long long file_size, vocab_size, train_words, arena_size, code_total, phrase_hash, files_hash;
+  long long word_pos_offset, count_offset, keep_offset, codelen_offset, code_start_offset;
+  long long code_offset, point_offset, arena_offset, table_offset, total_size;
+};
+
+char vocab_cache_file[MAX_PATH_STRING];
+
+// Writes 'size' bytes of 'data' to the cache, padded to VOCAB_CACHE_ALIGN;
+// returns the offset at which the section was written.  *pos is the current
+// file position, which need not be aligned if size is 0.
+long long WriteCacheSection(FILE *fo, const void *data, long long size, long long *pos) {
+  static const char zeros[VOCAB_CACHE_ALIGN] = {0};
+  long long offset = *pos, pad = (VOCAB_CACHE_ALIGN - (*pos + size) % VOCAB_CACHE_ALIGN) % VOCAB_CACHE_ALIGN;
+  fwrite(data, 1, size, fo);
+  fwrite(zeros, 1, pad, fo);
+  *pos += size + pad;
+  return offset;
+}
+
+void SaveVocabCache() {
+  struct vocab_cache_header h;
+  long long pos = 0;
+  FILE *fo = fopen(vocab_cache_file, "wb");
+  if (fo == NULL) {
+    printf("WARNING: unable to write vocabulary cache %s\n", vocab_cache_file);
+    return;
+  }
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, VOCAB_CACHE_MAGIC, 8);
+  h.version = VOCAB_CACHE_VERSION;
+  h.min_count = min_count;
+  h.sample = sample;
+  h.table_size = table_size;
+  h.file_size = file_size;
+  h.vocab_size = vocab_size;
+  h.train_words = train_words;
+  h.arena_size = vocab_arena_size;
+  h.code_total = vocab_code_start[vocab_size];
+  h.phrase_hash = phrase_table_hash;
+  h.files_hash = TrainFilesHash();
+  // The header is written twice: once to reserve its space, and again once
+  // the section offsets are known
+  WriteCacheSection(fo, &h, sizeof(h), &pos);
+  h.word_pos_offset = WriteCacheSection(fo, vocab_word_pos, vocab_size * sizeof(long long), &pos);
+  h.count_offset = WriteCacheSection(fo, vocab_count, vocab_size * sizeof(long long), &pos);
+  h.keep_offset = WriteCacheSection(fo, vocab_keep, vocab_size * sizeof(unsigned int), &pos);
+  h.codelen_offset = WriteCacheSection(fo, vocab_codelen, vocab_size * sizeof(char), &pos);
+  h.code_start_offset = WriteCacheSection(fo, vocab_code_start, (vocab_size + 1) * sizeof(long long), &pos);
+  h.code_offset = WriteCacheSection(fo, vocab_code, h.code_total * sizeof(char), &pos);
+  h.point_offset = WriteCacheSection(fo, vocab_point, h.code_total * sizeof(int), &pos);
+  h.arena_offset = WriteCacheSection(fo, vocab_arena, vocab_arena_size, &pos);
+  if (table != NULL) h.table_offset = WriteCacheSection(fo, table, (long long)table_size * sizeof(int), &pos);
+  h.total_size = pos;
+  fseek(fo, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, fo);
+  fclose(fo);
+  if (debug_mode > 0) printf("Saved vocabulary cache %s (%lld bytes)\n", vocab_cache_file, pos);
+}
+
+// Returns whether the section of 'size' bytes at 'offset' lies after the
+// header and within the cache
+static inline bool CacheSectionFits(const struct vocab_cache_header *h, long long offset, long long size) {
+  return (offset >= (long long)sizeof(*h)) && (size >= 0) && (size <= h->total_size) && (offset <= h->total_size - size);
+}
+
+// Returns whether every section of the cache lies within it, and the cache
+// within the file of 'length' bytes, so that a truncated or damaged cache is
+// not mapped
+bool VocabCacheIntact(const struct vocab_cache_header *h, long long length) {
+  if ((h->total_size > length) || (h->vocab_size < 1) || (h->vocab_size > h->total_size)
+      || (h->code_total < 0) || (h->code_total > h->total_size)) return false;
+  return CacheSectionFits(h, h->word_pos_offset, h->vocab_size * sizeof(long long))
+    && CacheSectionFits(h, h->count_offset, h->vocab_size * sizeof(long long))
+    && CacheSectionFits(h, h->keep_offset, h->vocab_size * sizeof(unsigned int))
+    && CacheSectionFits(h, h->codelen_offset, h->vocab_size * sizeof(char))
+    && CacheSectionFits(h, h->code_start_offset, (h->vocab_size + 1) * sizeof(long long))
+    && CacheSectionFits(h, h->code_offset, h->code_total * sizeof(char))
+    && CacheSectionFits(h, h->point_offset, h->code_total * sizeof(int))
+    && CacheSectionFits(h, h->arena_offset, h->arena_size)
+    && ((h->table_offset == 0) || CacheSectionFits(h, h->table_offset, (long long)h->table_size * sizeof(int)));
+}
+
+// Maps the vocabulary cache into memory, if it exists and was built from the
+// same training files with the same vocabulary parameters.  Returns true on
+// success; on failure nothing is changed and the vocabulary must be built.
+bool ReadVocabCache() {
+  struct vocab_cache_header h;
+  char *base;
+  long long a;
+  unsigned int hash;
+  FILE *fin = fopen(vocab_cache_file, "rb");
+  if (fin == NULL) return false;
+  if ((fread(&h, sizeof(h), 1, fin) != 1) || memcmp(h.magic, VOCAB_CACHE_MAGIC, 8)
+      || (h.version != VOCAB_CACHE_VERSION)) {
+    printf("Ignoring vocabulary cache %s: not a version %d cache file\n", vocab_cache_file, VOCAB_CACHE_VERSION);
+    fclose(fin);
+    return false;
+  }
+  if ((h.min_count != min_count) || (h.sample != sample) || (h.table_size != table_size)
+      || (h.file_size != TrainFileSize()) || (h.phrase_hash != (long long)phrase_table_hash)
+      || (h.files_hash != (long long)TrainFilesHash())) {
+    printf("Ignoring vocabulary cache %s: built with different data or parameters\n", vocab_cache_file);
+    fclose(fin);
+    return false;
   }
   fseek(fin, 0, SEEK_END);
-  file_size = ftell(fin);
+  if (!VocabCacheIntact(&h, ftell(fin))) {
+    printf("Ignoring vocabulary cache %s: truncated or damaged\n", vocab_cache_file);
+    fclose(fin);
+    return false;
+  }
+#ifdef _MSC_VER
+  base = (char *)malloc(h.total_size);
+  fseek(fin, 0, SEEK_SET);
+  if (base == NULL || fread(base, 1, h.total_size, fin) != h.total_size) {
+    free(base);
+    fclose(fin);
+    return false;
+  }
+#else
+  // A private mapping lets the pages be shared with the page cache (and
+  // with other jobs using the same cache) until something writes to them
+  base = mmap(NULL, h.total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fin), 0);
+  if (base == MAP_FAILED) {
+    fclose(fin);
+    return false;
+  }
+#endif
   fclose(fin);
+  vocab_size = vocab_max_size = h.vocab_size;
+  train_words = h.train_words;
+  file_size = h.file_size;
+  vocab_arena_size = vocab_arena_max_size = h.arena_size;
+  vocab_word_pos = (long long *)(base + h.word_pos_offset);
+  vocab_count = (long long *)(base + h.count_offset);
+  vocab_keep = (unsigned int *)(base + h.keep_offset);
+  vocab_codelen = base + h.codelen_offset;
+  vocab_code_start = (long long *)(base + h.code_start_offset);
+  vocab_code = base + h.code_offset;
+  vocab_point = (int *)(base + h.point_offset);
+  vocab_arena = base + h.arena_offset;
+  if (h.table_offset != 0) table = (int *)(base + h.table_offset);
+  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
+  for (a = 0; a < vocab_size; a++) {
+    hash = GetWordHash(VocabWord(a));
+    while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
+    vocab_hash[hash] = a;
+  }
+  if (debug_mode > 0) {
+    printf("Read vocabulary cache %s\n", vocab_cache_file);
+    printf("Vocab size: %lld\n", vocab_size);
+    printf("Words in train file: %lld\n", train_words);
+  }
+  return true;
+}
+
+// Co-occurrence reordering (-reorder N).  After SortVocab the ids, and so the
+// rows of syn0 and syn1neg, follow frequency rank, and the words of one context
+// window are scattered over the matrices.  This pass counts which words occur
+// near each other in the first N words of the training data and renumbers the
+// vocabulary so that they get nearby rows.  The words are chained together
+// greedily, strongest pair first (as Pettis and Hansen lay out procedures),
+// and the chains are laid out in order of their most frequent word.  Ids below
+// reorder_fixed (</s>, and the -hot-rows words) keep their place.
+// row_of_rank maps the frequency rank of a word to its new id, so the vectors
+// can still be saved in the usual order.
+#define REORDER_MAX_PAIRS (1 << 22)
+
+long long reorder_sample = 0;
+int *row_of_rank = NULL;
+
+// Returns the row of the word of frequency rank 'a'
+static inline long long RankRow(long long a) {
+  return (row_of_rank != NULL) ? row_of_rank[a] : a;
+}
+
+struct word_pair {
+  int a, b;
+  int count;
+};
+
+int PairCompare(const void *x, const void *y) {
+  return ((const struct word_pair *)y)->count - ((const struct word_pair *)x)->count;
+}
+
+int ChainRoot(int *parent, int v) {
+  while (parent[v] != v) v = parent[v] = parent[parent[v]];
+  return v;
+}
+
+// Counts the pairs of words (both with ids of at least 'fixed') that occur
+// within 'window' words of one another in the first reorder_sample words.
+// Returns the pairs found, sorted by count, in 'pairs'.
+long long CountWordPairs(struct word_pair **pairs, long long fixed) {
+  char word[MAX_STRING];
+  struct corpus_reader reader;
+  long long a, b, n = 0, words = 0, recent[MAX_SENTENCE_LENGTH];
+  long long recent_count = 0;
+  unsigned long long key, hash;
+  unsigned long long *keys = (unsigned long long *)calloc(REORDER_MAX_PAIRS, sizeof(unsigned long long));
+  int *counts = (int *)calloc(REORDER_MAX_PAIRS, sizeof(int));
+  int file;
+  if ((keys == NULL) || (counts == NULL)) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  for (file = 0; (file < train_file_count) && (words < reorder_sample); file++) {
+    if (!ReaderOpen(&reader, train_files[file])) {
+      printf("ERROR: training data file not found: %s\n", train_files[file]);
+      exit(1);
+    }
+    recent_count = 0;
+    while ((words < reorder_sample) && ReaderReadWord(word, &reader)) {
+      b = SearchVocab(word);
+      if (b == -1) continue;
+      words++;
+      if (b == 0) {
+        recent_count = 0;
+        continue;
+      }
+      if (b < fixed) continue;
+      for (a = (recent_count > window) ? recent_count - window : 0; a < recent_count; a++) {
+        if (recent[a % window] == b) continue;
+        // Pair keys are (smaller id + 1, larger id), so that 0 marks an empty slot
+        if (recent[a % window] < b) key = (unsigned long long)(recent[a % window] + 1) << 32 | b;
+        else key = (unsigned long long)(b + 1) << 32 | recent[a % window];
+        hash = (key * LCG_MUL) >> 20 & (REORDER_MAX_PAIRS - 1);
+        while ((keys[hash] != 0) && (keys[hash] != key)) hash = (hash + 1) & (REORDER_MAX_PAIRS - 1);
+        if (keys[hash] == 0) {
+          // Once the table is fairly full, only pairs already seen are counted
+          if (n >= REORDER_MAX_PAIRS * 0.7) continue;
+          keys[hash] = key;
+          n++;
+        }
+        counts[hash]++;
+      }
+      recent[recent_count % window] = b;
+      recent_count++;
+    }
+    ReaderClose(&reader);
+  }
+  *pairs = (struct word_pair *)malloc((n + 1) * sizeof(struct word_pair));
+  for (a = 0, b = 0; a < REORDER_MAX_PAIRS; a++) if (keys[a] != 0) {
+    (*pairs)[b].a = (keys[a] >> 32) - 1;
+    (*pairs)[b].b = keys[a] & 0xFFFFFFFF;
+    (*pairs)[b].count = counts[a];
+    b++;
+  }
+  free(keys);
+  free(counts);
+  qsort(*pairs, n, sizeof(struct word_pair), PairCompare);
+  if (debug_mode > 0) printf("Reordering the vocabulary: %lld pairs in %lld words\n", n, words);
+  return n;
+}
+
+// Renumbers the vocabulary so that word order[n] gets id n.  The arrays are
+// rewritten in place, as they may be mapped from the vocabulary cache.
+void PermuteVocab(const int *order) {
+  long long a, pos = 0;
+  long long size = (vocab_size + 1) * sizeof(long long);
+  int *new_id = (int *)malloc(vocab_size * sizeof(int));
+  char *tmp = (char *)malloc(size > vocab_code_start[vocab_size] * sizeof(int) ? size : vocab_code_start[vocab_size] * sizeof(int));
+  long long *ltmp = (long long *)tmp;
+  unsigned int *utmp = (unsigned int *)tmp;
+  int *itmp = (int *)tmp;
+  long long *code_start = (long long *)malloc(size);
+  for (a = 0; a < vocab_size; a++) new_id[order[a]] = a;
+  for (a = 0; a < vocab_size; a++) ltmp[a] = vocab_count[order[a]];
+  memcpy(vocab_count, ltmp, vocab_size * sizeof(long long));
+  for (a = 0; a < vocab_size; a++) ltmp[a] = vocab_word_pos[order[a]];
+  memcpy(vocab_word_pos, ltmp, vocab_size * sizeof(long long));
+  for (a = 0; a < vocab_size; a++) utmp[a] = vocab_keep[order[a]];
+  memcpy(vocab_keep, utmp, vocab_size * sizeof(unsigned int));
+  // The Huffman codes and points keep their inner node ids; only the words
+  // they belong to move
+  for (a = 0; a < vocab_size; a++) {
+    code_start[a] = pos;
+    pos += vocab_codelen[order[a]];
+  }
+  code_start[vocab_size] = pos;
+  for (a = 0; a < vocab_size; a++) memcpy(tmp + code_start[a], vocab_code + vocab_code_start[order[a]], vocab_codelen[order[a]]);
+  memcpy(vocab_code, tmp, pos);
+  for (a = 0; a < vocab_size; a++) memcpy(itmp + code_start[a], vocab_point + vocab_code_start[order[a]], vocab_codelen[order[a]] * sizeof(int));
+  memcpy(vocab_point, itmp, pos * sizeof(int));
+  for (a = 0; a < vocab_size; a++) tmp[a] = vocab_codelen[order[a]];
+  memcpy(vocab_codelen, tmp, vocab_size);
+  memcpy(vocab_code_start, code_start, size);
+  for (a = 0; a < vocab_hash_size; a++) if (vocab_hash[a] != -1) vocab_hash[a] = new_id[vocab_hash[a]];
+  if (table != NULL) for (a = 0; a < table_size; a++) table[a] = new_id[table[a]];
+  free(code_start);
+  free(tmp);
+  free(row_of_rank);
+  row_of_rank = new_id;
+}
+
+void ReorderVocab() {
+  struct word_pair *pairs;
+  long long a, n, fixed = (hot_rows > 1) ? hot_rows : 1;
+  int ra, rb, v, w, next_id = 0;
+  int *parent, *head, *tail, *next, *order;
+  if ((fixed >= vocab_size) || (window < 1)) return;
+  // The Huffman tree must be built from the vocabulary in frequency order
+  if (vocab_code == NULL) CreateBinaryTree();
+  n = CountWordPairs(&pairs, fixed);
+  parent = (int *)malloc(vocab_size * sizeof(int));
+  head = (int *)malloc(vocab_size * sizeof(int));
+  tail = (int *)malloc(vocab_size * sizeof(int));
+  next = (int *)malloc(vocab_size * sizeof(int));
+  order = (int *)malloc(vocab_size * sizeof(int));
+  for (v = 0; v < vocab_size; v++) {
+    parent[v] = head[v] = tail[v] = v;
+    next[v] = -1;
+  }
+  // Join two chains when the pair links the tail of one to the head of the other
+  for (a = 0; a < n; a++) {
+    v = pairs[a].a;
+    w = pairs[a].b;
+    ra = ChainRoot(parent, v);
+    rb = ChainRoot(parent, w);
+    if (ra == rb) continue;
+    if ((tail[rb] == w) && (head[ra] == v)) {
+      v = pairs[a].b;
+      w = pairs[a].a;
+      ra = ChainRoot(parent, v);
+      rb = ChainRoot(parent, w);
+    }
+    if ((tail[ra] != v) || (head[rb] != w)) continue;
+    next[v] = w;
+    tail[ra] = tail[rb];
+    parent[rb] = ra;
+  }
+  for (v = 0; v < fixed; v++) order[next_id++] = v;
+  for (v = fixed; v < vocab_size; v++) {
+    ra = ChainRoot(parent, v);
+    if (head[ra] == -1) continue;    // chain already laid out
+    for (w = head[ra]; w != -1; w = next[w]) order[next_id++] = w;
+    head[ra] = -1;
+  }
+  PermuteVocab(order);
+  free(pairs);
+  free(parent);
+  free(head);
+  free(tail);
+  free(next);
+  free(order);
 }
 
 // Allocate a (probably quite large) chunk of memory, neatly aligned
@@ -376,7 +1228,59 @@ void *Alloc(long long sizeInBytes, const char *memo) {
 	return ptr;
 }
 
+// Free memory obtained from Alloc.
+void FreeAligned(void *ptr) {
+#ifdef _MSC_VER
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+// Issue prefetches for every cache line of one row of layer1_size reals
+static inline void PrefetchRow(const real *row) {
+  long long c;
+  for (c = 0; c < layer1_size; c += 64 / sizeof(real)) PREFETCH(row + c);
+}
+
+// Returns the dot product of two rows.  The partial sums are kept in
+// ROW_LANES independent accumulators so the compiler can vectorize the loop
+// without reassociating a single floating-point sum.
+static inline real DotRow(const real *restrict x, const real *restrict y) {
+  real sum[ROW_LANES] = {0}, f = 0;
+  long long c, k;
+  for (c = 0; c + ROW_LANES <= layer1_size; c += ROW_LANES) {
+    for (k = 0; k < ROW_LANES; k++) sum[k] += x[c + k] * y[c + k];
+  }
+  for (; c < layer1_size; c++) f += x[c] * y[c];
+  for (k = 0; k < ROW_LANES; k++) f += sum[k];
+  return f;
+}
+
+// y += a * x, for rows x and y
+static inline void AxpyRow(real a, const real *restrict x, real *restrict y) {
+  long long c;
+  for (c = 0; c < layer1_size; c++) y[c] += a * x[c];
+}
+
+// x *= a, for row x
+static inline void ScaleRow(real *x, real a) {
+  long long c;
+  for (c = 0; c < layer1_size; c++) x[c] *= a;
+}
+
+// Sets 'sum' to the sum of the n given rows, streaming through each row once
+static inline void SumRows(real *restrict sum, const real **rows, long long n) {
+  long long a, c;
+  for (c = 0; c < layer1_size; c++) sum[c] = rows[0][c];
+  for (a = 1; a < n; a++) {
+    const real *restrict row = rows[a];
+    for (c = 0; c < layer1_size; c++) sum[c] += row[c];
+  }
+}
+
 void Pin(const char *word, long dimension, float value) {
+	if (!(pinDims & (1u << dimension))) return;		// dimension not selected by -pin-dims
 	long index = SearchVocab(word);
 	if (index < 0) {
 		printf("Can't pin \"%s\" because it is not found in vocabulary.\n", word);
@@ -389,8 +1293,9 @@ void Pin(const char *word, long dimension, float value) {
 		word, index, dimension, value);
 }
 
-// Return whether the given word (by index) has any pinned dimensions.
-bool IsPinned(long wordIndex) {
+// Return whether the given word (by index) has any pinned dimensions in the
+// given pins array.
+bool IsPinned(const real *pins, long wordIndex) {
 	long v = wordIndex * layer1_size;	
 	// Currently only the first 5 dimensions are ever pinned, so:
 	return pins[v] == 0 || pins[v+1] == 0 || pins[v+2] == 0
@@ -977,8 +1882,69 @@ void InitPins() {
 	Pin("revolver", 4, 1);
 	Pin("tank", 4, 1);
 	Pin("swing", 4, 0);
+
+	// Values from a blackbox CSV file, if one was given
+	if (pinDataFile[0] != 0) PinFromBlackboxData(pinDataFile);
+}
+
+// Parses a -pin-dims list such as "0,1,2" or "0-2,4" into a bit mask
+unsigned int ParsePinDims(const char *list) {
+  unsigned int mask = 0;
+  char *end;
+  long a, first, last;
+  while (*list) {
+    first = last = strtol(list, &end, 10);
+    if (*end == '-') last = strtol(end + 1, &end, 10);
+    if ((end == list) || (first < 0) || (last > 31) || (first > last)) {
+      printf("ERROR: invalid -pin-dims list\n");
+      exit(1);
+    }
+    for (a = first; a <= last; a++) mask |= 1u << a;
+    list = (*end == ',') ? end + 1 : end;
+    if ((*end != ',') && (*end != 0)) {
+      printf("ERROR: invalid -pin-dims list\n");
+      exit(1);
+    }
+  }
+  return mask;
+}
+
+// Adds a model with the current output file and pinning options
+void AddModel() {
+  if (model_count == MAX_MODELS) {
+    printf("ERROR: at most %d models can be trained together\n", MAX_MODELS);
+    exit(1);
+  }
+  strcpy(models[model_count].output_file, output_file);
+  models[model_count].pin = optPin;
+  models[model_count].pin_repeats = pinRepeats;
+  models[model_count].pin_dims = pinDims;
+  strcpy(models[model_count].pin_data, pinDataFile);
+  model_count++;
+}
+
+// Makes model m the current one
+void SelectModel(int m) {
+  strcpy(output_file, models[m].output_file);
+  optPin = models[m].pin;
+  pinRepeats = models[m].pin_repeats;
+  pinDims = models[m].pin_dims;
+  strcpy(pinDataFile, models[m].pin_data);
+  syn0 = models[m].syn0;
+  syn1 = models[m].syn1;
+  syn1neg = models[m].syn1neg;
+  pins = models[m].pins;
 }
 
+// Records the weights of the current model as those of model m
+void StoreModel(int m) {
+  models[m].syn0 = syn0;
+  models[m].syn1 = syn1;
+  models[m].syn1neg = syn1neg;
+  models[m].pins = pins;
+}
+
+// Allocates and initializes the weights of the current model
 void InitNet() {
   long long a, b;
   unsigned long long next_random = 1;
@@ -1006,84 +1972,892 @@ void InitNet() {
   }
   
   // Create a binary tree assigning unique codes to each vocabulary word
-  CreateBinaryTree();
+  // (unless it was already built, or read from the vocabulary cache)
+  if (vocab_code == NULL) CreateBinaryTree();
   
   // Initialize pins and pinned values
   InitPins();
   
   // Test
-  printf("IsPinned(%s): %d\n", "husband", IsPinned(SearchVocab("husband")));
-  printf("IsPinned(%s): %d\n", "gecko", IsPinned(SearchVocab("gecko")));
-  printf("IsPinned(%s): %d\n", "chicago", IsPinned(SearchVocab("chicago")));
-  printf("IsPinned(%s): %d\n", "shoe", IsPinned(SearchVocab("shoe")));
-  printf("IsPinned(%s): %d\n", "bucket", IsPinned(SearchVocab("bucket")));
+  printf("IsPinned(%s): %d\n", "husband", IsPinned(pins, SearchVocab("husband")));
+  printf("IsPinned(%s): %d\n", "gecko", IsPinned(pins, SearchVocab("gecko")));
+  printf("IsPinned(%s): %d\n", "chicago", IsPinned(pins, SearchVocab("chicago")));
+  printf("IsPinned(%s): %d\n", "shoe", IsPinned(pins, SearchVocab("shoe")));
+  printf("IsPinned(%s): %d\n", "bucket", IsPinned(pins, SearchVocab("bucket")));
 }
 
-void *TrainModelThread(void *id) {
-  long long a, b, d, cw, word, last_word, sentence_length = 0, sentence_position = 0;
-  long long word_count = 0, last_word_count = 0, sen[MAX_SENTENCE_LENGTH + 1];
-  long long l1, l2, c, target, label, local_iter = iter;
-  unsigned long long next_random = (long long)id;
-  real f, g;
-  clock_t now;
-  real *neu1 = (real *)calloc(layer1_size, sizeof(real));
-  real *neu1e = (real *)calloc(layer1_size, sizeof(real));
-  FILE *fi = fopen(train_file, "rb");
-  fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
-  while (1) {
-    if (word_count - last_word_count > 10000) {
-      word_count_actual += word_count - last_word_count;
-      last_word_count = word_count;
-      if ((debug_mode > 1)) {
-        now=clock();
-        printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  ", 13, alpha,
-         word_count_actual / (real)(iter * train_words + 1) * 100,
-         word_count_actual / ((real)(now - start + 1) / (real)CLOCKS_PER_SEC * 1000));
-        fflush(stdout);
-      }
-      alpha = starting_alpha * (1 - word_count_actual / (real)(iter * train_words + 1));
-      if (alpha < starting_alpha * 0.0001) alpha = starting_alpha * 0.0001;
+// Makes the current model a branch of 'base': it starts from a copy of the
+// base model's weights, with its own pins applied.  The first branch takes
+// over the base model's arrays instead of copying them.
+void ForkNet(const struct model *base, bool take) {
+  long long size = (long long)vocab_size * layer1_size * sizeof(real);
+  if (take) {
+    syn0 = base->syn0;
+    syn1 = base->syn1;
+    syn1neg = base->syn1neg;
+    pins = base->pins;
+  } else {
+    syn0 = Alloc(size, "syn0");
+    memcpy(syn0, base->syn0, size);
+    pins = Alloc(size, "pins");
+    if (hs) {
+      syn1 = Alloc(size, "syn1");
+      memcpy(syn1, base->syn1, size);
     }
-    // Read an entire sentence into memory (into sen[] array)
-    if (sentence_length == 0) {
-      while (1) {
-        word = ReadWordIndex(fi);
-        if (feof(fi)) break;
-        if (word == -1) continue;
-        word_count++;
-        if (word == 0) break;
+    if (negative > 0) {
+      syn1neg = Alloc(size, "syn1neg");
+      memcpy(syn1neg, base->syn1neg, size);
+    }
+  }
+  InitPins();
+}
+
+// The training threads do not read the corpus themselves.  A background
+// reader thread makes 'iter' passes over the training file, drops
+// out-of-vocabulary words, applies subsampling, and hands the surviving word
+// ids to the training threads in chunks through a bounded queue.  The reader
+// thus prepares the next part of the stream (including the start of the next
+// epoch) while the current part is being trained on.
+#define CHUNK_WORDS 10000
+#define CHUNK_TOKENS (2 * (CHUNK_WORDS + MAX_SENTENCE_LENGTH))
+
+struct token_chunk {
+  int *tokens;                         // surviving word ids; 0 ends a sentence
+  long long size;                      // number of entries used in tokens
+  long long words;                     // corpus words consumed to produce this chunk
+};
+
+struct chunk_queue {
+  struct token_chunk **items;
+  int capacity, head, count;
+  bool closed;
+  lock_t lock;
+  cond_t cond;
+};
+
+struct chunk_queue full_chunks, free_chunks;
+struct token_chunk *chunk_pool;
+int chunk_pool_size;
+int num_readers = 1, active_readers;
+long long next_segment, end_segment;
+lock_t segment_lock;
+
+void QueueInit(struct chunk_queue *q, int capacity) {
+  q->items = (struct token_chunk **)calloc(capacity, sizeof(struct token_chunk *));
+  q->capacity = capacity;
+  q->head = q->count = 0;
+  q->closed = false;
+  LockInit(&q->lock);
+  CondInit(&q->cond);
+}
+
+void QueuePush(struct chunk_queue *q, struct token_chunk *chunk) {
+  Lock(&q->lock);
+  q->items[(q->head + q->count) % q->capacity] = chunk;
+  q->count++;
+  CondBroadcast(&q->cond);
+  Unlock(&q->lock);
+}
+
+// Returns the oldest chunk in the queue, waiting for one if necessary;
+// returns NULL once the queue is closed and empty
+struct token_chunk *QueuePop(struct chunk_queue *q) {
+  struct token_chunk *chunk = NULL;
+  Lock(&q->lock);
+  while ((q->count == 0) && !q->closed) CondWait(&q->cond, &q->lock);
+  if (q->count > 0) {
+    chunk = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+  }
+  Unlock(&q->lock);
+  return chunk;
+}
+
+void QueueClose(struct chunk_queue *q) {
+  Lock(&q->lock);
+  q->closed = true;
+  CondBroadcast(&q->cond);
+  Unlock(&q->lock);
+}
+
+// Prepares the chunk queues and the reader work list for training iterations
+// first_iter .. last_iter - 1
+void InitChunkQueues(long long first_iter, long long last_iter) {
+  int a;
+  chunk_pool_size = (num_threads + num_readers) * 2;
+  chunk_pool = (struct token_chunk *)calloc(chunk_pool_size, sizeof(struct token_chunk));
+  QueueInit(&full_chunks, chunk_pool_size);
+  QueueInit(&free_chunks, chunk_pool_size);
+  for (a = 0; a < chunk_pool_size; a++) {
+    chunk_pool[a].tokens = (int *)malloc(CHUNK_TOKENS * sizeof(int));
+    QueuePush(&free_chunks, &chunk_pool[a]);
+  }
+  LockInit(&segment_lock);
+  next_segment = first_iter * segment_count;
+  end_segment = last_iter * segment_count;
+  active_readers = num_readers;
+}
+
+void FreeChunkQueues() {
+  int a;
+  for (a = 0; a < chunk_pool_size; a++) free(chunk_pool[a].tokens);
+  free(chunk_pool);
+  free(full_chunks.items);
+  free(free_chunks.items);
+}
+
+// Returns a monotonic wall-clock time in seconds
+double WallSeconds() {
+#ifdef _MSC_VER
+  return GetTickCount64() * 1e-3;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+// With -time-budget, training stops after time_budget seconds wherever it has
+// got to.  The learning rate then follows the clock rather than the word count
+// whenever that is further along, so the schedule is stretched or compressed
+// to end when the budget does, and the last, partial epoch still ends with
+// alpha at its minimum.
+double time_budget = 0, train_wall_start;
+volatile bool out_of_time = false;
+
+// Returns true once the time budget is used up
+bool OutOfTime() {
+  if ((time_budget > 0) && !out_of_time && (WallSeconds() - train_wall_start >= time_budget)) out_of_time = true;
+  return out_of_time;
+}
+
+// Returns the fraction of the training done, out of 'total_words' words or,
+// with -time-budget, of the time if that is further along
+real TrainingProgress(long long total_words) {
+  real progress = word_count_actual / (real)(total_words + 1), t;
+  if (time_budget > 0) {
+    t = (WallSeconds() - train_wall_start) / time_budget;
+    if (t > progress) progress = t;
+  }
+  return progress;
+}
+
+// Claims the next corpus segment to be read; the segments of all the epochs
+// being trained are handed out in order, so epoch e + 1 starts as soon as the
+// last segment of epoch e has been claimed.  A worker of a distributed run
+// only takes its own share of the segments.  Returns -1 when there are none left.
+long long NextSegment() {
+  long long task = -1;
+  Lock(&segment_lock);
+  while ((task < 0) && (next_segment < end_segment) && !out_of_time) {
+    task = next_segment++;
+    if ((task % segment_count) % ps_worker_count != ps_worker) task = -1;
+  }
+  Unlock(&segment_lock);
+  return task;
+}
+
+void *ReadCorpusThread(void *id) {
+  char word[MAX_STRING];
+  long long task, word_id, sentence_length = 0;
+  unsigned long long next_random = (long long)id + 1;
+  struct corpus_reader reader;
+  struct token_chunk *chunk = NULL;
+  while ((task = NextSegment()) >= 0) {
+    const struct corpus_segment *seg = &segments[task % segment_count];
+    if (!ReaderOpenSegment(&reader, seg)) {
+      printf("ERROR: training data file not found: %s\n", train_files[seg->file]);
+      exit(1);
+    }
+    while (1) {
+      if (chunk == NULL) {
+        chunk = QueuePop(&free_chunks);
+        chunk->size = 0;
+        chunk->words = 0;
+      }
+      if (!ReaderReadWord(word, &reader)) break;
+      if (reader.word_start >= seg->end) break;
+      word_id = SearchVocab(word);
+      if (word_id == -1) continue;
+      chunk->words++;
+      if (word_id != 0) {
         // The subsampling randomly discards frequent words while keeping the ranking same
-        if (sample > 0) {
-          real ran = (sqrt(vocab[word].count / (sample * train_words)) + 1) * (sample * train_words) / vocab[word].count;
-          next_random = next_random * (unsigned long long)25214903917 + 11;
-          if (ran < (next_random & 0xFFFF) / (real)65536) continue;
-        }
-        sen[sentence_length] = word;
+        next_random = next_random * LCG_MUL + LCG_ADD;
+        if (vocab_keep[word_id] < (next_random & 0xFFFF)) continue;
+        chunk->tokens[chunk->size++] = word_id;
         sentence_length++;
-        if (sentence_length >= MAX_SENTENCE_LENGTH) break;
+        if (sentence_length < MAX_SENTENCE_LENGTH) continue;
       }
-      sentence_position = 0;
-    }
-    if (feof(fi) || (word_count > train_words / num_threads)) {
-      word_count_actual += word_count - last_word_count;
-      local_iter--;
-      if (local_iter == 0) break;
-      word_count = 0;
-      last_word_count = 0;
+      // End of a sentence; the chunk may only be handed over between sentences
+      if (sentence_length > 0) chunk->tokens[chunk->size++] = 0;
       sentence_length = 0;
-      fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
+      if ((chunk->words >= CHUNK_WORDS) || (chunk->size >= CHUNK_WORDS)) {
+        QueuePush(&full_chunks, chunk);
+        chunk = NULL;
+        if (out_of_time) break;
+      }
+    }
+    ReaderClose(&reader);
+    // Sentences do not continue across segments
+    if (sentence_length > 0) chunk->tokens[chunk->size++] = 0;
+    sentence_length = 0;
+  }
+  if (chunk != NULL) QueuePush(&full_chunks, chunk);
+  // The last reader to finish tells the training threads there is no more data
+  Lock(&segment_lock);
+  active_readers--;
+  if (active_readers == 0) QueueClose(&full_chunks);
+  Unlock(&segment_lock);
+#ifdef _MSC_VER
+  _endthreadex(0);
+#elif defined  linux
+  pthread_exit(NULL);
+#endif
+  return NULL;
+}
+
+#ifdef _MSC_VER
+DWORD WINAPI ReadCorpusThread_win(LPVOID arg) {
+  ReadCorpusThread(arg);
+  return 0;
+}
+#endif
+
+// Draws a batch of 'negative' negative samples for 'word' into 'targets'.
+// The NEG_LANES lanes of 'lanes' have no dependency on one another, so the
+// generator loop vectorizes; samples equal to 'word' are rejected here rather
+// than in the training loop.  Returns the number of samples kept.
+static inline int DrawNegatives(long long *targets, long long word, unsigned long long *lanes) {
+  int d, k, n = 0;
+  long long target;
+  for (d = 0; d < negative; d += NEG_LANES) {
+    for (k = 0; k < NEG_LANES; k++) lanes[k] = lanes[k] * NEG_LCG_MUL + NEG_LCG_ADD;
+    for (k = 0; (k < NEG_LANES) && (d + k < negative); k++) {
+      target = table[(lanes[k] >> 16) % table_size];
+      if (target == 0) target = lanes[k] % (vocab_size - 1) + 1;
+      if (target != word) targets[n++] = target;
+    }
+  }
+  return n;
+}
+
+#ifndef _MSC_VER
+// Parameter server protocol.  Every message starts with a ps_header; rows are
+// sent as raw floats, so all the processes must run on machines of the same
+// byte order.
+//   PS_HELLO     count = vocab_size, matrix = layer1_size; reply: int status
+//   PS_PULL      followed by 'count' row ids; reply: count * layer1_size floats
+//   PS_PUSH      followed by 'count' row ids and as many rows of deltas to add
+//   PS_DONE      a worker has finished training
+//   PS_WAIT      reply (int 0) once all the workers have finished
+//   PS_SHUTDOWN  reply (int 0), then the server exits
+//   PS_SYNC      reply (int 0) once the earlier requests on the connection
+//                have been applied
+// 'matrix' selects syn0 (0) or syn1neg (1).
+#define PS_HELLO 1
+#define PS_PULL 2
+#define PS_PUSH 3
+#define PS_DONE 4
+#define PS_WAIT 5
+#define PS_SHUTDOWN 6
+#define PS_SYNC 7
+#define PS_POOL_SIZE 4096              // negative samples pulled per chunk
+
+struct ps_header {
+  int op, matrix, count;
+};
+
+real *ps_rows[2];                      // this server's rows of syn0 and syn1neg
+int ps_done = 0;
+lock_t ps_lock;
+cond_t ps_cond;
+
+bool WriteAll(int fd, const void *data, long long size) {
+  const char *p = (const char *)data;
+  long long n;
+  while (size > 0) {
+    n = write(fd, p, size);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, void *data, long long size) {
+  char *p = (char *)data;
+  long long n;
+  while (size > 0) {
+    n = read(fd, p, size);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Opens a socket for "unix:<path>" or "<host>:<port>" and either binds it for
+// listening or connects it; returns -1 on failure
+int PsSocket(const char *addr, bool listening) {
+  int fd = -1, one = 1;
+  if (!strncmp(addr, "unix:", 5)) {
+    struct sockaddr_un un;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strncpy(un.sun_path, addr + 5, sizeof(un.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (listening) unlink(un.sun_path);
+    if ((listening ? bind(fd, (struct sockaddr *)&un, sizeof(un)) : connect(fd, (struct sockaddr *)&un, sizeof(un))) != 0) {
+      close(fd);
+      return -1;
+    }
+  } else {
+    char host[MAX_STRING];
+    const char *port = strrchr(addr, ':');
+    struct addrinfo hints, *res;
+    if (port == NULL) return -1;
+    snprintf(host, sizeof(host), "%.*s", (int)(port - addr), addr);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (listening) hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host[0] ? host : NULL, port + 1, &hints, &res) != 0) return -1;
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0) {
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      if (listening) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if ((listening ? bind(fd, res->ai_addr, res->ai_addrlen) : connect(fd, res->ai_addr, res->ai_addrlen)) != 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    freeaddrinfo(res);
+  }
+  if ((fd >= 0) && listening && (listen(fd, 64) != 0)) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+// Serves one worker connection until it is closed
+void *ServeConnection(void *arg) {
+  int fd = (int)(long long)arg, status = 0;
+  long long a, c, cap = 0, local;
+  struct ps_header h;
+  int *ids = NULL;
+  real *rows = NULL;
+  while (ReadAll(fd, &h, sizeof(h))) {
+    if ((h.op == PS_PULL) || (h.op == PS_PUSH)) {
+      // A request never holds more rows than the shard has
+      if ((h.matrix < 0) || (h.matrix > 1) || (h.count < 0) || (h.count > vocab_size / ps_shard_count + 1)) break;
+      if (h.count > cap) {
+        cap = h.count;
+        ids = (int *)realloc(ids, cap * sizeof(int));
+        rows = (real *)realloc(rows, cap * layer1_size * sizeof(real));
+      }
+      if (!ReadAll(fd, ids, (long long)h.count * sizeof(int))) break;
+      for (a = 0; a < h.count; a++) {
+        if ((ids[a] < 0) || (ids[a] >= vocab_size) || (ids[a] % ps_shard_count != ps_shard)) break;
+      }
+      if (a < h.count) {
+        printf("ERROR: row %d does not belong to shard %d\n", ids[a], ps_shard);
+        break;
+      }
+      if (h.op == PS_PULL) {
+        for (a = 0; a < h.count; a++) {
+          local = ids[a] / ps_shard_count * layer1_size;
+          memcpy(rows + a * layer1_size, ps_rows[h.matrix] + local, layer1_size * sizeof(real));
+        }
+        if (!WriteAll(fd, rows, (long long)h.count * layer1_size * sizeof(real))) break;
+      } else {
+        if (!ReadAll(fd, rows, (long long)h.count * layer1_size * sizeof(real))) break;
+        // Deltas from different workers are added without locking, as the
+        // training threads of a single process do
+        for (a = 0; a < h.count; a++) {
+          local = ids[a] / ps_shard_count * layer1_size;
+          for (c = 0; c < layer1_size; c++) ps_rows[h.matrix][local + c] += rows[a * layer1_size + c];
+        }
+      }
+    } else if (h.op == PS_HELLO) {
+      status = ((h.count == vocab_size) && (h.matrix == layer1_size)) ? 0 : 1;
+      if (status) printf("ERROR: worker has vocab size %d and vector size %d\n", h.count, h.matrix);
+      if (!WriteAll(fd, &status, sizeof(int)) || status) break;
+    } else if (h.op == PS_DONE) {
+      Lock(&ps_lock);
+      ps_done++;
+      CondBroadcast(&ps_cond);
+      Unlock(&ps_lock);
+    } else if (h.op == PS_WAIT) {
+      Lock(&ps_lock);
+      while (ps_done < ps_worker_count) CondWait(&ps_cond, &ps_lock);
+      Unlock(&ps_lock);
+      if (!WriteAll(fd, &status, sizeof(int))) break;
+    } else if (h.op == PS_SYNC) {
+      // Requests on a connection are served in order, so the earlier pushes
+      // have been added by now
+      if (!WriteAll(fd, &status, sizeof(int))) break;
+    } else if (h.op == PS_SHUTDOWN) {
+      WriteAll(fd, &status, sizeof(int));
+      if (debug_mode > 0) printf("Shutting down\n");
+      exit(0);
+    } else break;
+  }
+  close(fd);
+  free(ids);
+  free(rows);
+  return NULL;
+}
+
+// A worker thread's connections to all the servers, and scratch space for
+// splitting a batch of rows among them
+struct ps_client {
+  int *fd;
+  int *ids;
+  long long *pos, *count, cap;
+  real *buf;
+};
+
+void PsClientOpen(struct ps_client *pc) {
+  char addr[MAX_PATH_STRING], *p;
+  int s = 0, tries;
+  pc->fd = (int *)malloc(ps_shard_count * sizeof(int));
+  pc->count = (long long *)malloc((ps_shard_count + 1) * sizeof(long long));
+  pc->ids = NULL;
+  pc->pos = NULL;
+  pc->buf = NULL;
+  pc->cap = 0;
+  strcpy(addr, ps_server_list);
+  for (p = strtok(addr, ","); p != NULL; p = strtok(NULL, ","), s++) {
+    // The servers may still be starting up
+    for (tries = 0; tries < 300; tries++) {
+      if ((pc->fd[s] = PsSocket(p, false)) >= 0) break;
+      usleep(100000);
+    }
+    if (pc->fd[s] < 0) {
+      printf("ERROR: can not connect to parameter server %s\n", p);
+      exit(1);
+    }
+  }
+}
+
+void PsClientClose(struct ps_client *pc) {
+  int s;
+  for (s = 0; s < ps_shard_count; s++) close(pc->fd[s]);
+  free(pc->fd);
+  free(pc->count);
+  free(pc->ids);
+  free(pc->pos);
+  free(pc->buf);
+}
+
+// Sends the same request, with no data, to every server and reads the int
+// replies of those that send one
+void PsBroadcast(struct ps_client *pc, int op, bool reply) {
+  struct ps_header h = {op, 0, 0};
+  int s, status;
+  if (op == PS_HELLO) {
+    h.count = vocab_size;
+    h.matrix = layer1_size;
+  }
+  for (s = 0; s < ps_shard_count; s++) WriteAll(pc->fd[s], &h, sizeof(h));
+  for (s = 0; reply && (s < ps_shard_count); s++) {
+    if (!ReadAll(pc->fd[s], &status, sizeof(int)) || status) {
+      printf("ERROR: parameter server %d refused the request\n", s);
+      exit(1);
+    }
+  }
+}
+
+// Groups the n row ids by server; afterwards the ids (and their positions in
+// the batch) for server s are pc->ids[pc->count[s] .. pc->count[s + 1] - 1]
+void PsSplit(struct ps_client *pc, const int *ids, long long n) {
+  long long a, s;
+  if (n > pc->cap) {
+    pc->cap = n;
+    pc->ids = (int *)realloc(pc->ids, n * sizeof(int));
+    pc->pos = (long long *)realloc(pc->pos, n * sizeof(long long));
+    pc->buf = (real *)realloc(pc->buf, n * layer1_size * sizeof(real));
+  }
+  for (s = 0; s <= ps_shard_count; s++) pc->count[s] = 0;
+  for (a = 0; a < n; a++) pc->count[ids[a] % ps_shard_count + 1]++;
+  for (s = 0; s < ps_shard_count; s++) pc->count[s + 1] += pc->count[s];
+  for (a = 0; a < n; a++) {
+    s = ids[a] % ps_shard_count;
+    pc->ids[pc->count[s]] = ids[a];
+    pc->pos[pc->count[s]++] = a;
+  }
+  for (s = ps_shard_count; s > 0; s--) pc->count[s] = pc->count[s - 1];
+  pc->count[0] = 0;
+}
+
+// Fetches the given rows of a matrix from the servers into 'rows'
+void PsPull(struct ps_client *pc, int matrix, const int *ids, long long n, real *rows) {
+  long long a, s;
+  struct ps_header h = {PS_PULL, matrix, 0};
+  PsSplit(pc, ids, n);
+  // Send every request before reading any reply, so the servers work in parallel
+  for (s = 0; s < ps_shard_count; s++) {
+    h.count = pc->count[s + 1] - pc->count[s];
+    WriteAll(pc->fd[s], &h, sizeof(h));
+    WriteAll(pc->fd[s], pc->ids + pc->count[s], h.count * sizeof(int));
+  }
+  for (s = 0; s < ps_shard_count; s++) {
+    if (!ReadAll(pc->fd[s], pc->buf + pc->count[s] * layer1_size, (pc->count[s + 1] - pc->count[s]) * layer1_size * sizeof(real))) {
+      printf("ERROR: lost connection to parameter server %lld\n", s);
+      exit(1);
+    }
+  }
+  for (a = 0; a < n; a++) memcpy(rows + pc->pos[a] * layer1_size, pc->buf + a * layer1_size, layer1_size * sizeof(real));
+}
+
+// Adds the given row deltas of a matrix on the servers
+void PsPush(struct ps_client *pc, int matrix, const int *ids, long long n, const real *deltas) {
+  long long a, s;
+  struct ps_header h = {PS_PUSH, matrix, 0};
+  PsSplit(pc, ids, n);
+  for (a = 0; a < n; a++) memcpy(pc->buf + a * layer1_size, deltas + pc->pos[a] * layer1_size, layer1_size * sizeof(real));
+  for (s = 0; s < ps_shard_count; s++) {
+    h.count = pc->count[s + 1] - pc->count[s];
+    if (!WriteAll(pc->fd[s], &h, sizeof(h)) || !WriteAll(pc->fd[s], pc->ids + pc->count[s], h.count * sizeof(int))
+      || !WriteAll(pc->fd[s], pc->buf + pc->count[s] * layer1_size, h.count * layer1_size * sizeof(real))) {
+      printf("ERROR: lost connection to parameter server %lld\n", s);
+      exit(1);
+    }
+  }
+}
+
+// Training thread of a distributed worker.  For each chunk it pulls the syn0
+// rows of the chunk's words and the syn1neg rows of those words plus a pool of
+// PS_POOL_SIZE negative samples, trains on local copies of them (drawing the
+// negatives from the pool), and pushes the changes back as deltas.
+void *TrainRemoteThread(void *id) {
+  long long a, b, c, d, n0, n1, cw, pos, end, word, last_word, target, label, cap = 0;
+  unsigned long long next_random = (long long)id + ps_worker * 1000;
+  int *slot = (int *)malloc(vocab_size * sizeof(int));
+  int *ids = (int *)malloc((CHUNK_TOKENS + PS_POOL_SIZE) * sizeof(int));
+  int *pool = (int *)malloc(PS_POOL_SIZE * sizeof(int));
+  real *rows0 = NULL, *rows1 = NULL, *old0 = NULL, *old1 = NULL;
+  real **ctx_rows = (real **)calloc(window * 2 + 1, sizeof(real *));
+  real *neu1 = (real *)calloc(layer1_size, sizeof(real));
+  real *neu1e = (real *)calloc(layer1_size, sizeof(real));
+  real f, g;
+  const int *sen;
+  struct token_chunk *chunk;
+  struct ps_client pc;
+  clock_t now;
+  PsClientOpen(&pc);
+  for (a = 0; a < vocab_size; a++) slot[a] = -1;
+  while ((chunk = QueuePop(&full_chunks)) != NULL) {
+    if (OutOfTime()) {
+      // Drain the queue so that the readers can finish
+      QueuePush(&free_chunks, chunk);
       continue;
     }
+    word_count_actual += chunk->words;
+    if ((debug_mode > 1)) {
+      now=clock();
+      printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  ", 13, alpha,
+       TrainingProgress(iter * train_words / ps_worker_count) * 100,
+       word_count_actual / ((real)(now - start + 1) / (real)CLOCKS_PER_SEC * 1000));
+      fflush(stdout);
+    }
+    alpha = starting_alpha * (1 - TrainingProgress(iter * train_words / ps_worker_count));
+    if (alpha < starting_alpha * 0.0001) alpha = starting_alpha * 0.0001;
+    // Give each distinct word a local slot: first the words of the chunk, then
+    // the negative samples
+    n0 = 0;
+    for (a = 0; a < chunk->size; a++) {
+      word = chunk->tokens[a];
+      if ((word != 0) && (slot[word] < 0)) {
+        slot[word] = n0;
+        ids[n0++] = word;
+      }
+    }
+    n1 = n0;
+    for (a = 0; a < PS_POOL_SIZE; a++) {
+      next_random = next_random * LCG_MUL + LCG_ADD;
+      target = table[(next_random >> 16) % table_size];
+      if (target == 0) target = next_random % (vocab_size - 1) + 1;
+      if (slot[target] < 0) {
+        slot[target] = n1;
+        ids[n1++] = target;
+      }
+      pool[a] = slot[target];
+    }
+    // The local rows are sized for the largest set of distinct words seen so far
+    if (n1 > cap) {
+      if (cap) {
+        FreeAligned(rows0);
+        FreeAligned(rows1);
+        FreeAligned(old0);
+        FreeAligned(old1);
+      }
+      cap = n1 + n1 / 4;
+      rows0 = Alloc(cap * layer1_size * sizeof(real), "rows0");
+      rows1 = Alloc(cap * layer1_size * sizeof(real), "rows1");
+      old0 = Alloc(cap * layer1_size * sizeof(real), "old0");
+      old1 = Alloc(cap * layer1_size * sizeof(real), "old1");
+    }
+    PsPull(&pc, 0, ids, n0, rows0);
+    PsPull(&pc, 1, ids, n1, rows1);
+    memcpy(old0, rows0, n0 * layer1_size * sizeof(real));
+    memcpy(old1, rows1, n1 * layer1_size * sizeof(real));
+    for (pos = 0; pos < chunk->size; pos = end + 1) {
+      sen = chunk->tokens + pos;
+      for (end = pos; (end < chunk->size) && (chunk->tokens[end] != 0); end++);
+      for (b = 0; b < end - pos; b++) {
+        word = slot[sen[b]];
+        next_random = next_random * LCG_MUL + LCG_ADD;
+        d = next_random % window;
+        cw = 0;
+        for (a = d; a < window * 2 + 1 - d; a++) if (a != window) {
+          c = b - window + a;
+          if ((c < 0) || (c >= end - pos)) continue;
+          ctx_rows[cw++] = rows0 + slot[sen[c]] * layer1_size;
+        }
+        if (cw == 0) continue;
+        if (cbow) {
+          SumRows(neu1, (const real **)ctx_rows, cw);
+          ScaleRow(neu1, 1 / (real)cw);
+        }
+        // In CBOW the averaged context predicts the word; in skip-gram each
+        // context word does on its own
+        for (last_word = 0; last_word < (cbow ? 1 : cw); last_word++) {
+          const real *in = cbow ? neu1 : ctx_rows[last_word];
+          for (c = 0; c < layer1_size; c++) neu1e[c] = 0;
+          for (d = 0; d < negative + 1; d++) {
+            if (d == 0) {
+              target = word;
+              label = 1;
+            } else {
+              next_random = next_random * LCG_MUL + LCG_ADD;
+              target = pool[(next_random >> 16) % PS_POOL_SIZE];
+              if (target == word) continue;
+              label = 0;
+            }
+            f = DotRow(in, rows1 + target * layer1_size);
+            if (f > MAX_EXP) g = (label - 1) * alpha;
+            else if (f < -MAX_EXP) g = (label - 0) * alpha;
+            else g = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
+            AxpyRow(g, rows1 + target * layer1_size, neu1e);
+            AxpyRow(g, in, rows1 + target * layer1_size);
+          }
+          if (cbow) for (a = 0; a < cw; a++) AxpyRow(1, neu1e, ctx_rows[a]);
+          else AxpyRow(1, neu1e, ctx_rows[last_word]);
+        }
+      }
+    }
+    QueuePush(&free_chunks, chunk);
+    // Push what changed
+    for (a = 0; a < n0 * layer1_size; a++) rows0[a] -= old0[a];
+    for (a = 0; a < n1 * layer1_size; a++) rows1[a] -= old1[a];
+    PsPush(&pc, 0, ids, n0, rows0);
+    PsPush(&pc, 1, ids, n1, rows1);
+    for (a = 0; a < n1; a++) slot[ids[a]] = -1;
+  }
+  // Pushes are not acknowledged: wait until the servers have applied them, so
+  // that the model worker 0 saves once every worker is done has all of them
+  PsBroadcast(&pc, PS_SYNC, true);
+  PsClientClose(&pc);
+  free(slot);
+  free(ids);
+  free(pool);
+  if (cap) {
+    FreeAligned(rows0);
+    FreeAligned(rows1);
+    FreeAligned(old0);
+    FreeAligned(old1);
+  }
+  free(ctx_rows);
+  free(neu1);
+  free(neu1e);
+  pthread_exit(NULL);
+}
+#endif
+
+// Hot-row caching (-hot-rows K).  The vocabulary is sorted by count, so rows
+// 0 .. K-1 of syn0 and syn1neg belong to the most frequent words, which every
+// thread updates all the time (and the negative samples are drawn mostly from
+// them too).  With the cache, each training thread updates private copies of
+// those rows instead and adds its changes to the shared rows every hot_merge
+// words, so the threads do not fight over the same cache lines on every word.
+
+struct hot_cache {
+  long long rows;                      // number of rows cached, 0 if off
+  real *syn0, *syn1neg;                // this thread's copies of the hot rows
+  real *syn0_base, *syn1neg_base;      // the shared rows as of the last merge
+};
+
+void HotCacheInit(struct hot_cache *hc) {
+  long long size;
+  hc->rows = (hot_rows < vocab_size) ? hot_rows : vocab_size;
+  if (hc->rows <= 0) {
+    hc->rows = 0;
+    return;
+  }
+  size = hc->rows * layer1_size * sizeof(real);
+  hc->syn0 = (real *)Alloc(size, "hot syn0");
+  hc->syn0_base = (real *)Alloc(size, "hot syn0 base");
+  if (negative > 0) {
+    hc->syn1neg = (real *)Alloc(size, "hot syn1neg");
+    hc->syn1neg_base = (real *)Alloc(size, "hot syn1neg base");
+  }
+}
+
+void HotCacheFree(struct hot_cache *hc) {
+  if (hc->rows == 0) return;
+  FreeAligned(hc->syn0);
+  FreeAligned(hc->syn0_base);
+  if (negative > 0) {
+    FreeAligned(hc->syn1neg);
+    FreeAligned(hc->syn1neg_base);
+  }
+}
+
+// Adds the changes made to the private rows since the last merge to the
+// shared ones (without locking, like the training threads themselves), then
+// takes a fresh copy of them
+void HotCacheSync(real *local, real *base, real *shared, long long rows) {
+  long long c, n = rows * layer1_size;
+  for (c = 0; c < n; c++) {
+    shared[c] += local[c] - base[c];
+    local[c] = base[c] = shared[c];
+  }
+}
+
+void HotCacheMerge(struct hot_cache *hc, real *syn0, real *syn1neg) {
+  if (hc->rows == 0) return;
+  HotCacheSync(hc->syn0, hc->syn0_base, syn0, hc->rows);
+  if (negative > 0) HotCacheSync(hc->syn1neg, hc->syn1neg_base, syn1neg, hc->rows);
+}
+
+void HotCacheLoad(struct hot_cache *hc, const real *syn0, const real *syn1neg) {
+  long long size = hc->rows * layer1_size * sizeof(real);
+  if (hc->rows == 0) return;
+  memcpy(hc->syn0, syn0, size);
+  memcpy(hc->syn0_base, syn0, size);
+  if (negative > 0) {
+    memcpy(hc->syn1neg, syn1neg, size);
+    memcpy(hc->syn1neg_base, syn1neg, size);
+  }
+}
+
+// Returns the row of 'word' in 'shared', or in 'hot' if the word is cached
+static inline real *HotRow(real *shared, real *hot, long long hot_count, long long word) {
+  return (word < hot_count ? hot : shared) + word * layer1_size;
+}
+
+void *TrainModelThread(void *id) {
+#ifndef _MSC_VER
+  if (ps_server_list[0] != 0) return TrainRemoteThread(id);
+#endif
+  long long a, b, d, cw, word, last_word, sentence_length = 0, sentence_position = 0;
+  long long chunk_pos = 0;
+  int model_id = 0;
+  // The weights of the model being trained, which hide the globals of the
+  // same names: every chunk is trained on by each model in turn
+  real *syn0, *syn1, *syn1neg, *pins;
+  int pinRepeats;
+  unsigned long long chunk_random = 0, chunk_lanes[NEG_LANES] = {0};
+  long long l1, l2, c, target, label;
+  unsigned long long next_random = (long long)id;
+  unsigned long long neg_lanes[NEG_LANES];
+  long long *neg_targets = (long long *)calloc(negative + NEG_LANES, sizeof(long long));
+  real **ctx_rows = (real **)calloc(window * 2 + 1, sizeof(real *));
+  real **out_rows = (real **)calloc(negative + NEG_LANES + 1, sizeof(real *));
+  real *out_g = (real *)calloc(negative + NEG_LANES + 1, sizeof(real));
+  int neg_count = 0;
+  real f, g;
+  const char *code;
+  const int *point;
+  const int *sen = NULL;
+  struct token_chunk *chunk = NULL;
+  clock_t now;
+  real *neu1 = (real *)calloc(layer1_size, sizeof(real));
+  real *neu1e = (real *)calloc(layer1_size, sizeof(real));
+  real *in_row, *out_row;
+  struct hot_cache hot;
+  int hot_model = -1;                  // the model whose rows are in 'hot'
+  long long hot_words = 0;             // words trained since the last merge
+  HotCacheInit(&hot);
+  // Seed the negative sampling lanes with consecutive states of one stream
+  neg_lanes[0] = ~(unsigned long long)(long long)id;
+  for (a = 1; a < NEG_LANES; a++) neg_lanes[a] = neg_lanes[a - 1] * LCG_MUL + LCG_ADD;
+  while (1) {
+    // Take the next sentence from the current chunk, fetching a new chunk from
+    // the reader when this one is used up
+    if (sentence_length == 0) {
+      if ((chunk != NULL) && (chunk_pos >= chunk->size)) {
+        if (++model_id < model_count) {
+          // Replay the chunk for the next model, with the same random draws
+          chunk_pos = 0;
+          next_random = chunk_random;
+          for (a = 0; a < NEG_LANES; a++) neg_lanes[a] = chunk_lanes[a];
+        } else {
+          QueuePush(&free_chunks, chunk);
+          chunk = NULL;
+        }
+      }
+      if (chunk == NULL) {
+        chunk = QueuePop(&full_chunks);
+        if (chunk == NULL) break;
+        if (OutOfTime()) {
+          // Drain the queue so that the readers can finish
+          QueuePush(&free_chunks, chunk);
+          chunk = NULL;
+          continue;
+        }
+        chunk_pos = 0;
+        model_id = 0;
+        chunk_random = next_random;
+        for (a = 0; a < NEG_LANES; a++) chunk_lanes[a] = neg_lanes[a];
+        word_count_actual += chunk->words;
+        if ((debug_mode > 1)) {
+          now=clock();
+          printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  ", 13, alpha,
+           TrainingProgress(iter * train_words) * 100,
+           word_count_actual / ((real)(now - start + 1) / (real)CLOCKS_PER_SEC * 1000));
+          fflush(stdout);
+        }
+        alpha = starting_alpha * (1 - TrainingProgress(iter * train_words));
+        if (alpha < starting_alpha * 0.0001) alpha = starting_alpha * 0.0001;
+      }
+      syn0 = models[model_id].syn0;
+      syn1 = models[model_id].syn1;
+      syn1neg = models[model_id].syn1neg;
+      pins = models[model_id].pins;
+      pinRepeats = models[model_id].pin_repeats;
+      if (hot.rows && (hot_model != model_id)) {
+        if (hot_model >= 0) HotCacheMerge(&hot, models[hot_model].syn0, models[hot_model].syn1neg);
+        HotCacheLoad(&hot, syn0, syn1neg);
+        hot_model = model_id;
+        hot_words = 0;
+      } else if (hot.rows && (hot_words >= hot_merge)) {
+        HotCacheMerge(&hot, syn0, syn1neg);
+        hot_words = 0;
+      }
+      sen = chunk->tokens + chunk_pos;
+      while ((chunk_pos < chunk->size) && (chunk->tokens[chunk_pos] != 0)) chunk_pos++;
+      sentence_length = chunk->tokens + chunk_pos - sen;
+      chunk_pos++;    // skip the end-of-sentence marker
+      sentence_position = 0;
+      if (sentence_length == 0) continue;
+    }
     // get the "center" word (which, in skipgram, we try to predict)
     word = sen[sentence_position];
     if (word == -1) continue;
+    code = vocab_code + vocab_code_start[word];
+    point = vocab_point + vocab_code_start[word];
     // clear accumulators
     for (c = 0; c < layer1_size; c++) neu1[c] = 0;
     for (c = 0; c < layer1_size; c++) neu1e[c] = 0;
     next_random = next_random * (unsigned long long)25214903917 + 11;
     b = next_random % window;
     if (cbow) {  //train the cbow architecture
-      // in -> hidden
+      // in -> hidden: gather the context rows once, then sum them
       cw = 0;
       for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
         c = sentence_position - window + a;
@@ -1091,56 +2865,50 @@ void *TrainModelThread(void *id) {
         if (c >= sentence_length) continue;
         last_word = sen[c];
         if (last_word == -1) continue;
-        for (c = 0; c < layer1_size; c++) neu1[c] += syn0[c + last_word * layer1_size];
-        cw++;
+        ctx_rows[cw++] = HotRow(syn0, hot.syn0, hot.rows, last_word);
       }
       if (cw) {
-        for (c = 0; c < layer1_size; c++) neu1[c] /= cw;
-        if (hs) for (d = 0; d < vocab[word].codelen; d++) {
+        SumRows(neu1, (const real **)ctx_rows, cw);
+        ScaleRow(neu1, 1 / (real)cw);
+        if (hs) for (d = 0; d < vocab_codelen[word]; d++) {
           f = 0;
-          l2 = vocab[word].point[d] * layer1_size;
+          l2 = point[d] * layer1_size;
+          if (d + 1 < vocab_codelen[word]) PrefetchRow(syn1 + point[d + 1] * layer1_size);
           // Propagate hidden -> output
           for (c = 0; c < layer1_size; c++) f += neu1[c] * syn1[c + l2];
           if (f <= -MAX_EXP) continue;
           else if (f >= MAX_EXP) continue;
           else f = expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
           // 'g' is the gradient multiplied by the learning rate
-          g = (1 - vocab[word].code[d] - f) * alpha;
+          g = (1 - code[d] - f) * alpha;
           // Propagate errors output -> hidden
           for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1[c + l2];
           // Learn weights hidden -> output
           for (c = 0; c < layer1_size; c++) syn1[c + l2] += g * neu1[c];
         }
-        // NEGATIVE SAMPLING
-        if (negative > 0) for (d = 0; d < negative + 1; d++) {
-          if (d == 0) {
-            target = word;
-            label = 1;
-          } else {
-            next_random = next_random * (unsigned long long)25214903917 + 11;
-            target = table[(next_random >> 16) % table_size];
-            if (target == 0) target = next_random % (vocab_size - 1) + 1;
-            if (target == word) continue;
-            label = 0;
+        // NEGATIVE SAMPLING: score the positive word and all negatives against
+        // neu1 as one matrix-vector product, then apply all the updates
+        if (negative > 0) {
+          neg_count = DrawNegatives(neg_targets, word, neg_lanes);
+          out_rows[0] = HotRow(syn1neg, hot.syn1neg, hot.rows, word);
+          for (d = 0; d < neg_count; d++) out_rows[d + 1] = HotRow(syn1neg, hot.syn1neg, hot.rows, neg_targets[d]);
+          for (d = 0; (d < 2) && (d < neg_count + 1); d++) PrefetchRow(out_rows[d]);
+          for (d = 0; d < neg_count + 1; d++) {
+            // Fetch the row needed two steps from now
+            if (d + 2 < neg_count + 1) PrefetchRow(out_rows[d + 2]);
+            label = (d == 0);
+            f = DotRow(neu1, out_rows[d]);
+            if (f > MAX_EXP) out_g[d] = (label - 1) * alpha;
+            else if (f < -MAX_EXP) out_g[d] = (label - 0) * alpha;
+            else out_g[d] = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
+          }
+          for (d = 0; d < neg_count + 1; d++) {
+            AxpyRow(out_g[d], out_rows[d], neu1e);
+            AxpyRow(out_g[d], neu1, out_rows[d]);
           }
-          l2 = target * layer1_size;
-          f = 0;
-          for (c = 0; c < layer1_size; c++) f += neu1[c] * syn1neg[c + l2];
-          if (f > MAX_EXP) g = (label - 1) * alpha;
-          else if (f < -MAX_EXP) g = (label - 0) * alpha;
-          else g = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
-          for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1neg[c + l2];
-          for (c = 0; c < layer1_size; c++) syn1neg[c + l2] += g * neu1[c];
-        }
-        // hidden -> in
-        for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
-          c = sentence_position - window + a;
-          if (c < 0) continue;
-          if (c >= sentence_length) continue;
-          last_word = sen[c];
-          if (last_word == -1) continue;
-          for (c = 0; c < layer1_size; c++) syn0[c + last_word * layer1_size] += neu1e[c];
         }
+        // hidden -> in, over the context rows gathered above
+        for (a = 0; a < cw; a++) AxpyRow(1, neu1e, ctx_rows[a]);
       }
     } else {  //train skip-gram
       // loop over the window of context words in the sentence
@@ -1154,55 +2922,60 @@ void *TrainModelThread(void *id) {
         if (last_word == -1) continue;	// (out-of-vocabulary word; ignore)
         // get a pointer into our input layer, thus finding the embedding for last_word
         l1 = last_word * layer1_size;
+        in_row = HotRow(syn0, hot.syn0, hot.rows, last_word);
         
         // if either the target word or the context word contains a pinned value,
         // give it more weight by repeating this training process multiple times
         int repeats = 1;
-        if (IsPinned(word) || IsPinned(last_word)) repeats = pinRepeats;
+        if (IsPinned(pins, word) || IsPinned(pins, last_word)) repeats = pinRepeats;
         
         for (int repeat=0; repeat < repeats; repeat++) {
 			// clear the error terms corresponding to our hidden layer
 			for (c = 0; c < layer1_size; c++) neu1e[c] = 0;
 			// HIERARCHICAL SOFTMAX
-			if (hs) for (d = 0; d < vocab[word].codelen; d++) {	// ?
+			if (hs) for (d = 0; d < vocab_codelen[word]; d++) {	// ?
 			  f = 0;
-			  l2 = vocab[word].point[d] * layer1_size;
+			  l2 = point[d] * layer1_size;
+			  if (d + 1 < vocab_codelen[word]) PrefetchRow(syn1 + point[d + 1] * layer1_size);
 			  // Propagate hidden -> output
-			  for (c = 0; c < layer1_size; c++) f += syn0[c + l1] * syn1[c + l2];
+			  for (c = 0; c < layer1_size; c++) f += in_row[c] * syn1[c + l2];
 			  if (f <= -MAX_EXP) continue;
 			  else if (f >= MAX_EXP) continue;
 			  else f = expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
 			  // 'g' is the gradient multiplied by the learning rate
-			  g = (1 - vocab[word].code[d] - f) * alpha;
+			  g = (1 - code[d] - f) * alpha;
 			  // Propagate errors output -> hidden
 			  for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1[c + l2];
 			  // Learn weights hidden -> output
-			  for (c = 0; c < layer1_size; c++) syn1[c + l2] += g * syn0[c + l1];
+			  for (c = 0; c < layer1_size; c++) syn1[c + l2] += g * in_row[c];
 			}
 			// NEGATIVE SAMPLING
-			if (negative > 0) for (d = 0; d < negative + 1; d++) {
+			if (negative > 0) {
+			  neg_count = DrawNegatives(neg_targets, word, neg_lanes);
+			  if (neg_count > 0) PrefetchRow(HotRow(syn1neg, hot.syn1neg, hot.rows, neg_targets[0]));
+			}
+			if (negative > 0) for (d = 0; d < neg_count + 1; d++) {
 			  if (d == 0) {
 				target = word;
 				label = 1;
 			  } else {
-				next_random = next_random * (unsigned long long)25214903917 + 11;
-				target = table[(next_random >> 16) % table_size];
-				if (target == 0) target = next_random % (vocab_size - 1) + 1;
-				if (target == word) continue;
+				target = neg_targets[d - 1];
 				label = 0;
 			  }
-			  l2 = target * layer1_size;
+			  // Fetch the row needed two steps from now
+			  if (d + 1 < neg_count) PrefetchRow(HotRow(syn1neg, hot.syn1neg, hot.rows, neg_targets[d + 1]));
+			  out_row = HotRow(syn1neg, hot.syn1neg, hot.rows, target);
 			  f = 0;
-			  for (c = 0; c < layer1_size; c++) f += syn0[c + l1] * syn1neg[c + l2];
+			  for (c = 0; c < layer1_size; c++) f += in_row[c] * out_row[c];
 			  if (f > MAX_EXP) g = (label - 1) * alpha;
 			  else if (f < -MAX_EXP) g = (label - 0) * alpha;
 			  else g = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
-			  for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1neg[c + l2];
-			  for (c = 0; c < layer1_size; c++) syn1neg[c + l2] += g * syn0[c + l1];
+			  for (c = 0; c < layer1_size; c++) neu1e[c] += g * out_row[c];
+			  for (c = 0; c < layer1_size; c++) out_row[c] += g * in_row[c];
 			}
 			// Learn weights input -> hidden (thus updating embedding of last_word),
 			// gated by our 'pins' array.
-			for (c = 0; c < layer1_size; c++) syn0[l1 + c] += neu1e[c] * pins[l1 + c];
+			for (c = 0; c < layer1_size; c++) in_row[c] += neu1e[c] * pins[l1 + c];
 			//if (last_word == iKing) printf("Updated iKing(%ld); dim 5 is now %f, pins[%lld]=%f\n", iKing, syn0[l1 + 5], l1 + 5, pins[l1 + 5]);
 		
 		} // next repeat
@@ -1211,6 +2984,7 @@ void *TrainModelThread(void *id) {
     } // end of "if skipgram" (vs CBOW)
     
     sentence_position++;
+    hot_words++;
     if (sentence_position >= sentence_length) {
       sentence_length = 0;
       continue;
@@ -1218,9 +2992,14 @@ void *TrainModelThread(void *id) {
 
   } // next word in file
   
-  fclose(fi);
+  if (hot_model >= 0) HotCacheMerge(&hot, models[hot_model].syn0, models[hot_model].syn1neg);
+  HotCacheFree(&hot);
   free(neu1);
   free(neu1e);
+  free(neg_targets);
+  free(ctx_rows);
+  free(out_rows);
+  free(out_g);
 #ifdef _MSC_VER
 _endthreadex(0);
 #elif defined  linux 
@@ -1235,89 +3014,700 @@ DWORD WINAPI TrainModelThread_win(LPVOID tid){
 }
 #endif
 
-void TrainModel() {
-  long a, b, c, d;
+// K-means clustering of the word vectors (-classes).  As in the original
+// word2vec, the centroids are kept at unit length and each word goes to the
+// centroid with the largest dot product.  The assignment step is split among
+// num_threads threads, and each thread scores a block of words against a
+// block of centroids at a time, like a blocked matrix product, so that both
+// blocks stay in cache.  The centroids start from k-means++ seeding on a
+// sample of the words (or, with -kmeans-init 0, from round-robin classes), and
+// the iterations stop once no more than kmeans_tol of the words change class.
+// With -kmeans-batch B, each iteration instead moves the centroids towards B
+// random words (mini-batch k-means), and all the words are assigned at the end.
+#define KMEANS_BLOCK 32
+#define KMEANS_SEED_SAMPLE 64          // words sampled per class for k-means++
+
+int kmeans_init = 1;
+long long kmeans_iter = 0, kmeans_batch = 0;
+real kmeans_tol = 0.001;
+
+struct kmeans_task {
+  const real *cent;
+  int classes;
+  const int *rows;                     // the rows to assign, or NULL for rows first .. last - 1
+  int *cl;                             // class of each row, indexed like rows
+  long long first, last, changes;
+};
+
+void *KMeansAssignThread(void *arg) {
+  struct kmeans_task *t = (struct kmeans_task *)arg;
+  long long a, b, c, d, n, m;
+  const real *row[KMEANS_BLOCK];
+  real best[KMEANS_BLOCK], x;
+  int best_id[KMEANS_BLOCK];
+  t->changes = 0;
+  for (a = t->first; a < t->last; a += KMEANS_BLOCK) {
+    n = (t->last - a < KMEANS_BLOCK) ? t->last - a : KMEANS_BLOCK;
+    for (b = 0; b < n; b++) {
+      row[b] = syn0 + (t->rows != NULL ? t->rows[a + b] : a + b) * layer1_size;
+      best[b] = -1e30;
+      best_id[b] = 0;
+    }
+    for (c = 0; c < t->classes; c += KMEANS_BLOCK) {
+      m = (t->classes - c < KMEANS_BLOCK) ? t->classes - c : KMEANS_BLOCK;
+      for (b = 0; b < n; b++) for (d = 0; d < m; d++) {
+        x = DotRow(t->cent + (c + d) * layer1_size, row[b]);
+        if (x > best[b]) {
+          best[b] = x;
+          best_id[b] = c + d;
+        }
+      }
+    }
+    for (b = 0; b < n; b++) {
+      if (t->cl[a + b] != best_id[b]) t->changes++;
+      t->cl[a + b] = best_id[b];
+    }
+  }
+#ifdef _MSC_VER
+  _endthreadex(0);
+#elif defined  linux
+  pthread_exit(NULL);
+#endif
+  return NULL;
+}
+
+#ifdef _MSC_VER
+DWORD WINAPI KMeansAssignThread_win(LPVOID arg) {
+  KMeansAssignThread(arg);
+  return 0;
+}
+#endif
+
+// Assigns the n words 'rows' (or rows 0 .. n - 1 if NULL) to their closest
+// centroids in 'cl', using all the threads; returns the number of changes
+long long KMeansAssign(const real *cent, int k, const int *rows, long long n, int *cl) {
+  long long a, changes = 0;
+  struct kmeans_task *tasks = (struct kmeans_task *)calloc(num_threads, sizeof(struct kmeans_task));
+  for (a = 0; a < num_threads; a++) {
+    tasks[a].cent = cent;
+    tasks[a].classes = k;
+    tasks[a].rows = rows;
+    tasks[a].cl = cl;
+    tasks[a].first = n * a / num_threads;
+    tasks[a].last = n * (a + 1) / num_threads;
+  }
+#ifdef _MSC_VER
+  HANDLE *pt = (HANDLE *)malloc(num_threads * sizeof(HANDLE));
+  for (a = 0; a < num_threads; a++) pt[a] = (HANDLE)_beginthreadex(NULL, 0, KMeansAssignThread_win, &tasks[a], 0, NULL);
+  WaitForMultipleObjects(num_threads, pt, TRUE, INFINITE);
+  for (a = 0; a < num_threads; a++) CloseHandle(pt[a]);
+#elif defined  linux
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, KMeansAssignThread, &tasks[a]);
+  for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+#endif
+  for (a = 0; a < num_threads; a++) changes += tasks[a].changes;
+  free(pt);
+  free(tasks);
+  return changes;
+}
+
+// Scales x to unit length, unless it is all zeros
+void NormalizeRow(real *x) {
+  real len = sqrt(DotRow(x, x));
+  if (len > 0) ScaleRow(x, 1 / len);
+}
+
+// Sets each centroid to the normalized mean of the words in its class;
+// centroids of empty classes are left as they are
+void KMeansUpdate(real *cent, const int *cl, int k) {
+  long long a, *count = (long long *)calloc(k, sizeof(long long));
+  real *sum = (real *)calloc((long long)k * layer1_size, sizeof(real));
+  for (a = 0; a < vocab_size; a++) {
+    AxpyRow(1, syn0 + a * layer1_size, sum + cl[a] * layer1_size);
+    count[cl[a]]++;
+  }
+  for (a = 0; a < k; a++) if (count[a] > 0) {
+    memcpy(cent + a * layer1_size, sum + a * layer1_size, layer1_size * sizeof(real));
+    NormalizeRow(cent + a * layer1_size);
+  }
+  free(count);
+  free(sum);
+}
+
+// Chooses k initial centroids by k-means++ seeding on a random sample of the
+// words: each new centroid is a word picked with probability proportional to
+// the square of its distance (1 - cosine) to the nearest centroid so far
+void KMeansPlusPlus(real *cent, int k, unsigned long long *next_random) {
+  long long a, n = (long long)k * KMEANS_SEED_SAMPLE, pick;
+  int j;
+  int *sample;
+  real *dist, *norm, d;
+  double total, r;
+  if (n > vocab_size) n = vocab_size;
+  sample = (int *)malloc(n * sizeof(int));
+  dist = (real *)malloc(n * sizeof(real));
+  norm = (real *)malloc(n * sizeof(real));
+  for (a = 0; a < n; a++) {
+    *next_random = *next_random * LCG_MUL + LCG_ADD;
+    sample[a] = (n == vocab_size) ? a : (*next_random >> 16) % vocab_size;
+    norm[a] = sqrt(DotRow(syn0 + sample[a] * layer1_size, syn0 + sample[a] * layer1_size));
+    if (norm[a] == 0) norm[a] = 1;
+    dist[a] = 1;
+  }
+  for (j = 0; j < k; j++) {
+    total = 0;
+    for (a = 0; a < n; a++) total += dist[a] * dist[a];
+    *next_random = *next_random * LCG_MUL + LCG_ADD;
+    r = ((*next_random >> 16) & 0xFFFFFF) / (double)0x1000000 * total;
+    for (pick = 0; pick < n - 1; pick++) {
+      r -= dist[pick] * dist[pick];
+      if (r < 0) break;
+    }
+    if (total == 0) pick = (*next_random >> 16) % n;
+    memcpy(cent + j * layer1_size, syn0 + sample[pick] * layer1_size, layer1_size * sizeof(real));
+    NormalizeRow(cent + j * layer1_size);
+    for (a = 0; a < n; a++) {
+      d = 1 - DotRow(cent + j * layer1_size, syn0 + sample[a] * layer1_size) / norm[a];
+      if (d < 0) d = 0;
+      if (d < dist[a]) dist[a] = d;
+    }
+  }
+  free(sample);
+  free(dist);
+  free(norm);
+}
+
+// Mini-batch k-means: each batch of kmeans_batch random words is assigned to
+// the current centroids, then each centroid moves towards its words with a
+// step of 1 / (number of words it has had so far)
+void KMeansMiniBatch(real *cent, int k, long long batches, unsigned long long *next_random) {
+  long long a, b, n = (kmeans_batch < vocab_size) ? kmeans_batch : vocab_size;
+  long long *seen = (long long *)calloc(k, sizeof(long long));
+  int *rows = (int *)malloc(n * sizeof(int));
+  int *cl = (int *)malloc(n * sizeof(int));
+  real *c;
+  for (b = 0; b < batches; b++) {
+    for (a = 0; a < n; a++) {
+      *next_random = *next_random * LCG_MUL + LCG_ADD;
+      rows[a] = (*next_random >> 16) % vocab_size;
+    }
+    KMeansAssign(cent, k, rows, n, cl);
+    for (a = 0; a < n; a++) {
+      c = cent + cl[a] * layer1_size;
+      seen[cl[a]]++;
+      ScaleRow(c, 1 - 1 / (real)seen[cl[a]]);
+      AxpyRow(1 / (real)seen[cl[a]], syn0 + rows[a] * layer1_size, c);
+    }
+    for (a = 0; a < k; a++) NormalizeRow(cent + a * layer1_size);
+  }
+  free(seen);
+  free(rows);
+  free(cl);
+}
+
+// Clusters the rows of syn0 into 'classes' classes; returns the class of
+// each row
+int *ClusterWords() {
+  long long a, it, changes, max_iter = kmeans_iter;
+  unsigned long long next_random = 1;
+  int k = classes;
+  int *cl = (int *)malloc(vocab_size * sizeof(int));
+  real *cent = (real *)calloc((long long)k * layer1_size, sizeof(real));
+  if (max_iter <= 0) max_iter = (kmeans_batch > 0) ? 100 : 10;
+  if (kmeans_init == 0) {
+    for (a = 0; a < vocab_size; a++) cl[RankRow(a)] = a % k;
+    KMeansUpdate(cent, cl, k);
+  } else {
+    for (a = 0; a < vocab_size; a++) cl[a] = -1;
+    KMeansPlusPlus(cent, k, &next_random);
+  }
+  if (kmeans_batch > 0) {
+    KMeansMiniBatch(cent, k, max_iter, &next_random);
+    KMeansAssign(cent, k, NULL, vocab_size, cl);
+  } else for (it = 0; it < max_iter; it++) {
+    changes = KMeansAssign(cent, k, NULL, vocab_size, cl);
+    if (debug_mode > 1) printf("K-means iteration %lld: %lld words changed class\n", it + 1, changes);
+    if (changes <= kmeans_tol * vocab_size) break;
+    if (it + 1 < max_iter) KMeansUpdate(cent, cl, k);
+  }
+  free(cent);
+  return cl;
+}
+
+// Text output (-binary 0).  Formatting the floats is most of the cost, so
+// blocks of TEXT_BLOCK_WORDS words are formatted by num_threads threads at a
+// time and then written out in order.  Each value is written in the shortest
+// form that reads back as the same float.
+#define TEXT_BLOCK_WORDS 1024
+#define MAX_FLOAT_STRING 16
+
+static const double pow10_table[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+  1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Writes the shortest decimal form of x (at most 9 significant digits) that
+// reads back as the same float to 'out'; returns its length
+int FormatFloat(char *out, float x) {
+  char digits[24], *o = out;
+  float ax = fabsf(x);
+  double v = ax, back;
+  long long m = 0;
+  int e, k, n, p, i;
+  if ((x == 0) || !isfinite(x)) return sprintf(out, "%g", x);
+  e = (int)floor(log10(v));
+  // Very small and very large values would need inexact powers of ten
+  if ((e < -13) || (e > 20)) return sprintf(out, "%.9g", x);
+  if (x < 0) *o++ = '-';
+  // Find the fewest digits p for which the value rounded to p digits reads
+  // back as x; m / 10^k is then correctly rounded, as m and 10^k are exact
+  for (p = 1; p <= 9; p++) {
+    k = p - 1 - e;
+    m = llround((k >= 0) ? v * pow10_table[k] : v / pow10_table[-k]);
+    back = (k >= 0) ? m / pow10_table[k] : m * pow10_table[-k];
+    if ((float)back == ax) break;
+  }
+  if (p > 9) return sprintf(out, "%.9g", x);
+  n = sprintf(digits, "%lld", m);
+  e = n - 1 - k;                       // m may have rounded up to p + 1 digits
+  while ((n > 1) && (digits[n - 1] == '0')) n--;
+  if ((e >= 0) && (e < 9)) {
+    for (i = 0; i < n; i++) {
+      if (i == e + 1) *o++ = '.';
+      *o++ = digits[i];
+    }
+    for (; i <= e; i++) *o++ = '0';
+  } else if ((e < 0) && (e >= -5)) {
+    *o++ = '0';
+    *o++ = '.';
+    for (i = -1; i > e; i--) *o++ = '0';
+    memcpy(o, digits, n);
+    o += n;
+  } else {
+    *o++ = digits[0];
+    if (n > 1) *o++ = '.';
+    memcpy(o, digits + 1, n - 1);
+    o += n - 1;
+    o += sprintf(o, "e%c%02d", e < 0 ? '-' : '+', abs(e));
+  }
+  *o = 0;
+  return o - out;
+}
+
+struct text_block {
+  long long first, last;               // ranks of the words to format
+  char *buf;
+  long long length;
+};
+
+void *FormatTextThread(void *arg) {
+  struct text_block *t = (struct text_block *)arg;
+  long long a, b, c;
+  char *o = t->buf;
+  for (a = t->first; a < t->last; a++) {
+    c = RankRow(a);
+    o += sprintf(o, "%s ", VocabWord(c));
+    for (b = 0; b < layer1_size; b++) {
+      o += FormatFloat(o, syn0[c * layer1_size + b]);
+      *o++ = ' ';
+    }
+    *o++ = '\n';
+  }
+  t->length = o - t->buf;
+#ifdef _MSC_VER
+  _endthreadex(0);
+#elif defined  linux
+  pthread_exit(NULL);
+#endif
+  return NULL;
+}
+
+#ifdef _MSC_VER
+DWORD WINAPI FormatTextThread_win(LPVOID arg) {
+  FormatTextThread(arg);
+  return 0;
+}
+#endif
+
+// Writes syn0 to 'fo' in the text format
+void SaveTextModel(FILE *fo) {
+  long long a, b, round;
+  long long block_size = TEXT_BLOCK_WORDS * (MAX_STRING + 2 + layer1_size * (MAX_FLOAT_STRING + 1));
+  struct text_block *blocks = (struct text_block *)calloc(num_threads, sizeof(struct text_block));
+#ifdef _MSC_VER
+  HANDLE *pt = (HANDLE *)malloc(num_threads * sizeof(HANDLE));
+#elif defined  linux
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+#endif
+  for (a = 0; a < num_threads; a++) blocks[a].buf = (char *)malloc(block_size);
+  fprintf(fo, "%lld %lld\n", vocab_size, layer1_size);
+  for (round = 0; round < vocab_size; round += num_threads * TEXT_BLOCK_WORDS) {
+    for (a = 0; a < num_threads; a++) {
+      blocks[a].first = round + a * TEXT_BLOCK_WORDS;
+      blocks[a].last = blocks[a].first + TEXT_BLOCK_WORDS;
+      if (blocks[a].first > vocab_size) blocks[a].first = vocab_size;
+      if (blocks[a].last > vocab_size) blocks[a].last = vocab_size;
+    }
+#ifdef _MSC_VER
+    for (a = 0; a < num_threads; a++) pt[a] = (HANDLE)_beginthreadex(NULL, 0, FormatTextThread_win, &blocks[a], 0, NULL);
+    WaitForMultipleObjects(num_threads, pt, TRUE, INFINITE);
+    for (a = 0; a < num_threads; a++) CloseHandle(pt[a]);
+#elif defined  linux
+    for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, FormatTextThread, &blocks[a]);
+    for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+#endif
+    for (b = 0; b < num_threads; b++) fwrite(blocks[b].buf, 1, blocks[b].length, fo);
+  }
+  for (a = 0; a < num_threads; a++) free(blocks[a].buf);
+  free(blocks);
+  free(pt);
+}
+
+// Aligned model format (-binary 2), described in model-format.h; its
+// sections are written by WriteCacheSection
+int save_norms = 1, quantize = MODEL_FLOAT32;
+
+// Converts x to IEEE half precision, rounding to nearest even
+unsigned short FloatToHalf(float x) {
+  unsigned int f, sign, m, s, r, h;
+  memcpy(&f, &x, sizeof(f));
+  sign = (f >> 16) & 0x8000;
+  f &= 0x7fffffff;
+  if (f > 0x7f800000) return sign | 0x7e00;                // nan
+  if (f >= 0x477ff000) return sign | 0x7c00;               // rounds to infinity
+  if (f >= 0x38800000) return sign | ((f - 0x38000000 + 0xfff + ((f >> 13) & 1)) >> 13);
+  if (f < 0x33000000) return sign;                         // rounds to zero
+  // Subnormal half: the mantissa shifted down by the missing exponent
+  m = (f & 0x7fffff) | 0x800000;
+  s = 126 - (f >> 23);
+  h = m >> s;
+  r = m & ((1u << s) - 1);
+  if ((r > (1u << (s - 1))) || ((r == (1u << (s - 1))) && (h & 1))) h++;
+  return sign | h;
+}
+
+// Encodes the rows of ranks first .. first + n - 1 into 'out' in the type
+// chosen by -quantize, setting their norms (of the values as stored) and,
+// for int8, their scales.  Returns the number of bytes written to 'out'.
+long long PackRows(void *out, long long first, long long n, real *norms, real *scales) {
+  long long a, b;
+  real *row, max, len, v;
+  unsigned short *half = (unsigned short *)out;
+  signed char *q = (signed char *)out;
+  for (a = 0; a < n; a++) {
+    row = syn0 + RankRow(first + a) * layer1_size;
+    len = 0;
+    if (quantize == MODEL_FLOAT32) {
+      memcpy((real *)out + a * layer1_size, row, layer1_size * sizeof(real));
+      len = DotRow(row, row);
+    } else if (quantize == MODEL_FLOAT16) {
+      for (b = 0; b < layer1_size; b++) {
+        half[a * layer1_size + b] = FloatToHalf(row[b]);
+        v = HalfToFloat(half[a * layer1_size + b]);
+        len += v * v;
+      }
+    } else {
+      max = 0;
+      for (b = 0; b < layer1_size; b++) if (fabs(row[b]) > max) max = fabs(row[b]);
+      scales[first + a] = max / 127;
+      for (b = 0; b < layer1_size; b++) {
+        q[a * layer1_size + b] = (max > 0) ? (signed char)lrintf(row[b] * 127 / max) : 0;
+        v = q[a * layer1_size + b] * scales[first + a];
+        len += v * v;
+      }
+    }
+    norms[first + a] = sqrt(len);
+  }
+  return n * layer1_size * ((quantize == MODEL_FLOAT32) ? sizeof(real) : (quantize == MODEL_FLOAT16) ? 2 : 1);
+}
+
+// Writes syn0 to 'fo' in the aligned model format, with large sequential
+// writes; the rows are gathered and encoded in blocks unless they can be
+// written straight from syn0
+void SaveAlignedModel(FILE *fo) {
+  struct model_file_header h;
+  long long a, n, bytes, pos = 0, size = 0;
+  long long *index = (long long *)malloc((vocab_size + 1) * sizeof(long long));
+  char *strings;
+  real *block, *norms, *scales = NULL;
+  for (a = 0; a < vocab_size; a++) {
+    index[a] = size;
+    size += strlen(VocabWord(RankRow(a))) + 1;
+  }
+  index[vocab_size] = size;
+  strings = (char *)malloc(size);
+  for (a = 0; a < vocab_size; a++) strcpy(strings + index[a], VocabWord(RankRow(a)));
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MODEL_FILE_MAGIC, 8);
+  h.version = MODEL_FILE_VERSION;
+  h.dtype = quantize;
+  h.vocab_size = vocab_size;
+  h.dim = layer1_size;
+  // As with the vocabulary cache, the header is written again at the end,
+  // once the section offsets are known
+  WriteCacheSection(fo, &h, sizeof(h), &pos);
+  h.index_offset = WriteCacheSection(fo, index, (vocab_size + 1) * sizeof(long long), &pos);
+  h.strings_offset = WriteCacheSection(fo, strings, size, &pos);
+  block = (real *)malloc(CHUNK_WORDS * layer1_size * sizeof(real));
+  norms = (real *)malloc(vocab_size * sizeof(real));
+  if (quantize == MODEL_INT8) scales = (real *)malloc(vocab_size * sizeof(real));
+  h.matrix_offset = pos;
+  for (a = 0; a < vocab_size; a += n) {
+    n = (vocab_size - a < CHUNK_WORDS) ? vocab_size - a : CHUNK_WORDS;
+    bytes = PackRows(block, a, n, norms, scales);
+    if ((row_of_rank == NULL) && (quantize == MODEL_FLOAT32)) fwrite(syn0 + a * layer1_size, 1, bytes, fo);
+    else fwrite(block, 1, bytes, fo);
+    pos += bytes;
+  }
+  WriteCacheSection(fo, block, 0, &pos);
+  if (save_norms) h.norms_offset = WriteCacheSection(fo, norms, vocab_size * sizeof(real), &pos);
+  if (scales != NULL) h.scales_offset = WriteCacheSection(fo, scales, vocab_size * sizeof(real), &pos);
+  h.total_size = pos;
+  fseek(fo, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, fo);
+  free(index);
+  free(strings);
+  free(block);
+  free(norms);
+  free(scales);
+}
+
+// Saves the word vectors (or, with -classes, the word clusters) of the
+// current model
+void SaveModel() {
+  long a, c;
   FILE *fo;
-  printf("Starting training using file %s\n", train_file);
-  starting_alpha = alpha;
-  if (read_vocab_file[0] != 0) ReadVocab(); else LearnVocabFromTrainFile();
-  if (save_vocab_file[0] != 0) SaveVocab();
-  if (output_file[0] == 0) return;
-  InitNet();
-  if (negative > 0) InitUnigramTable();
-  start = clock();
-  
+  fo = fopen(output_file, "wb");
+  if (fo == NULL) {
+    printf("ERROR: can not write %s\n", output_file);
+    exit(1);
+  }
+  setvbuf(fo, NULL, _IOFBF, READ_BUFFER_SIZE);
+  if ((classes == 0) && (binary == 2)) SaveAlignedModel(fo);
+  else if ((classes == 0) && (binary == 0)) SaveTextModel(fo);
+  else if (classes == 0) {
+    // Save the word vectors
+    fprintf(fo, "%lld %lld\n", vocab_size, layer1_size);
+    for (a = 0; a < vocab_size; a++) {
+      c = RankRow(a);
+      fprintf(fo, "%s ", VocabWord(c));
+      fwrite(&syn0[c * layer1_size], sizeof(real), layer1_size, fo);
+      fprintf(fo, "\n");
+    }
+  } else {
+    // Cluster the word vectors and save the classes
+    int *cl = ClusterWords();
+    for (a = 0; a < vocab_size; a++) fprintf(fo, "%s %d\n", VocabWord(RankRow(a)), cl[RankRow(a)]);
+    free(cl);
+  }
+  fclose(fo);
+}
+
+// Trains the models on iterations first_iter .. last_iter - 1 of the data
+void RunTraining(long long first_iter, long long last_iter) {
+  long a;
+  InitChunkQueues(first_iter, last_iter);
 #ifdef _MSC_VER
-	HANDLE *pt = (HANDLE *)malloc(num_threads * sizeof(HANDLE));
+	HANDLE *pt = (HANDLE *)malloc((num_threads + num_readers) * sizeof(HANDLE));
+	for (int i = 0; i < num_readers; i++){
+		pt[num_threads + i] = (HANDLE)_beginthreadex(NULL, 0, ReadCorpusThread_win, (void *)i, 0, NULL);
+	}
 	for (int i = 0; i < num_threads; i++){
 		pt[i] = (HANDLE)_beginthreadex(NULL, 0, TrainModelThread_win, (void *)i, 0, NULL);
 	}
-	WaitForMultipleObjects(num_threads, pt, TRUE, INFINITE);
-	for (int i = 0; i < num_threads; i++){
+	WaitForMultipleObjects(num_threads + num_readers, pt, TRUE, INFINITE);
+	for (int i = 0; i < num_threads + num_readers; i++){
 		CloseHandle(pt[i]);
 	}
 	free(pt);
 #elif defined  linux 
-  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  pthread_t *pt = (pthread_t *)malloc((num_threads + num_readers) * sizeof(pthread_t));
+  for (a = 0; a < num_readers; a++) pthread_create(&pt[num_threads + a], NULL, ReadCorpusThread, (void *)a);
   for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainModelThread, (void *)a);
-  for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+  for (a = 0; a < num_threads + num_readers; a++) pthread_join(pt[a], NULL);
+  free(pt);
 #endif
+  FreeChunkQueues();
+}
 
-  fo = fopen(output_file, "wb");
-  if (classes == 0) {
-    // Save the word vectors
-    fprintf(fo, "%lld %lld\n", vocab_size, layer1_size);
-    for (a = 0; a < vocab_size; a++) {
-      fprintf(fo, "%s ", vocab[a].word);
-      if (binary) for (b = 0; b < layer1_size; b++) fwrite(&syn0[a * layer1_size + b], sizeof(real), 1, fo);
-      else for (b = 0; b < layer1_size; b++) fprintf(fo, "%lf ", syn0[a * layer1_size + b]);
-      fprintf(fo, "\n");
+// Builds or loads the vocabulary, Huffman tree and sampling tables
+void PrepareVocab() {
+  printf("Starting training using file %s\n", train_file);
+  ListTrainFiles(train_file);
+  SegmentTrainFiles();
+  if ((debug_mode > 0) && (train_file_count > 1)) printf("Training files: %d\n", train_file_count);
+  if ((phrases_file[0] != 0) && (phrase_pool == NULL)) ReadPhraseTable();
+  if ((vocab_cache_file[0] == 0) || !ReadVocabCache()) {
+    if (read_vocab_file[0] != 0) ReadVocab(); else LearnVocabFromTrainFile();
+    if (vocab_cache_file[0] != 0) {
+      CreateBinaryTree();
+      if (negative > 0) InitUnigramTable();
+      SaveVocabCache();
     }
+  }
+  if (save_vocab_file[0] != 0) SaveVocab();
+  if (reorder_sample > 0) ReorderVocab();
+}
+
+// Trains and saves the configured models
+void TrainModels() {
+  int m;
+  double wall_start = WallSeconds();
+  starting_alpha = alpha;
+  word_count_actual = 0;
+  train_wall_start = wall_start;
+  out_of_time = false;
+  if ((negative > 0) && (table == NULL)) InitUnigramTable();
+  start = clock();
+  if ((branch_iter > 0) && (branch_iter < iter)) {
+    // Train the shared prefix once, then fork the models from it
+    struct model configured[MAX_MODELS], base;
+    int configured_count = model_count;
+    memcpy(configured, models, sizeof(models));
+    model_count = 0;
+    output_file[0] = 0;
+    optPin = false;
+    pinRepeats = 1;
+    pinDims = ~0u;
+    pinDataFile[0] = 0;
+    AddModel();
+    InitNet();
+    StoreModel(0);
+    if (debug_mode > 0) printf("Training the base model for %lld iterations\n", branch_iter);
+    RunTraining(0, branch_iter);
+    base = models[0];
+    memcpy(models, configured, sizeof(models));
+    model_count = configured_count;
+    for (m = 0; m < model_count; m++) {
+      SelectModel(m);
+      ForkNet(&base, m == 0);
+      StoreModel(m);
+    }
+    if (debug_mode > 0) printf("\nForked %d models\n", model_count);
+    RunTraining(branch_iter, iter);
   } else {
-    // Run K-means on the word vectors
-    int clcn = classes, iter = 10, closeid;
-    int *centcn = (int *)malloc(classes * sizeof(int));
-    int *cl = (int *)calloc(vocab_size, sizeof(int));
-    real closev, x;
-    real *cent = (real *)calloc(classes * layer1_size, sizeof(real));
-    for (a = 0; a < vocab_size; a++) cl[a] = a % clcn;
-    for (a = 0; a < iter; a++) {
-      for (b = 0; b < clcn * layer1_size; b++) cent[b] = 0;
-      for (b = 0; b < clcn; b++) centcn[b] = 1;
-      for (c = 0; c < vocab_size; c++) {
-        for (d = 0; d < layer1_size; d++) cent[layer1_size * cl[c] + d] += syn0[c * layer1_size + d];
-        centcn[cl[c]]++;
-      }
-      for (b = 0; b < clcn; b++) {
-        closev = 0;
-        for (c = 0; c < layer1_size; c++) {
-          cent[layer1_size * b + c] /= centcn[b];
-          closev += cent[layer1_size * b + c] * cent[layer1_size * b + c];
-        }
-        closev = sqrt(closev);
-        for (c = 0; c < layer1_size; c++) cent[layer1_size * b + c] /= closev;
-      }
-      for (c = 0; c < vocab_size; c++) {
-        closev = -10;
-        closeid = 0;
-        for (d = 0; d < clcn; d++) {
-          x = 0;
-          for (b = 0; b < layer1_size; b++) x += cent[layer1_size * d + b] * syn0[c * layer1_size + b];
-          if (x > closev) {
-            closev = x;
-            closeid = d;
-          }
-        }
-        cl[c] = closeid;
+    for (m = 0; m < model_count; m++) {
+      SelectModel(m);
+      InitNet();
+      StoreModel(m);
+    }
+    RunTraining(0, iter);
+  }
+  if (debug_mode > 1) printf("\n");
+  if (debug_mode > 0) printf("Trained %lld words in %.1f s, %.0f words/sec\n", word_count_actual,
+    WallSeconds() - wall_start, word_count_actual / (WallSeconds() - wall_start));
+  if (out_of_time && (debug_mode > 0)) printf("Time budget of %g s used up after %.2f of %lld iterations\n", time_budget,
+    word_count_actual / (double)train_words, iter);
+  for (m = 0; m < model_count; m++) {
+    SelectModel(m);
+    SaveModel();
+  }
+}
+
+// Releases the weights of all the models
+void FreeModels() {
+  int m;
+  for (m = 0; m < model_count; m++) {
+    FreeAligned(models[m].syn0);
+    FreeAligned(models[m].pins);
+    if (hs) FreeAligned(models[m].syn1);
+    if (negative > 0) FreeAligned(models[m].syn1neg);
+  }
+  model_count = 0;
+}
+
+#ifndef _MSC_VER
+// Runs a parameter server (-ps-serve) holding shard ps_shard of the rows
+// of syn0 and syn1neg.  The vocabulary must be the same as the workers'; the
+// rows start with the values InitNet would give them.
+void ServeRows() {
+  long long a, b, rows;
+  unsigned long long next_random = 1;
+  int fd, conn;
+  pthread_t pt;
+  PrepareVocab();
+  rows = (vocab_size - ps_shard + ps_shard_count - 1) / ps_shard_count;
+  ps_rows[0] = Alloc(rows * layer1_size * sizeof(real), "syn0 shard");
+  ps_rows[1] = Alloc(rows * layer1_size * sizeof(real), "syn1neg shard");
+  for (a = 0; a < rows * layer1_size; a++) ps_rows[1][a] = 0;
+  for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++) {
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    if (a % ps_shard_count == ps_shard) {
+      ps_rows[0][a / ps_shard_count * layer1_size + b] = (((next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size;
+    }
+  }
+  LockInit(&ps_lock);
+  CondInit(&ps_cond);
+  fd = PsSocket(ps_serve_addr, true);
+  if (fd < 0) {
+    printf("ERROR: can not listen on %s\n", ps_serve_addr);
+    exit(1);
+  }
+  if (debug_mode > 0) printf("Serving shard %d of %d (%lld rows) on %s\n", ps_shard, ps_shard_count, rows, ps_serve_addr);
+  fflush(stdout);
+  while (1) {
+    conn = accept(fd, NULL, NULL);
+    if (conn < 0) continue;
+    pthread_create(&pt, NULL, ServeConnection, (void *)(long long)conn);
+    pthread_detach(pt);
+  }
+}
+
+// Runs a distributed worker (-ps-servers).  Worker ps_worker trains on every
+// ps_worker_count-th segment of the data against the rows held by the
+// servers.  Once all the workers are done, worker 0 reports the overall
+// throughput, fetches syn0, saves the model and shuts the servers down.
+void TrainRemote() {
+  long long a, b, n;
+  int *ids;
+  double wall_start;
+  struct ps_client pc;
+  if ((models_file[0] != 0) || (sweep_file[0] != 0) || (branch_iter > 0) || optPin || (pinDataFile[0] != 0)) {
+    printf("ERROR: distributed training does not support -models, -sweep, -branch-iter, -pin or -pin-data\n");
+    exit(1);
+  }
+  min_segments = 4 * ps_worker_count;
+  PrepareVocab();
+  if ((negative <= 0) || hs) {
+    printf("ERROR: distributed training supports negative sampling only\n");
+    exit(1);
+  }
+  if (table == NULL) InitUnigramTable();
+  PsClientOpen(&pc);
+  PsBroadcast(&pc, PS_HELLO, true);
+  starting_alpha = alpha;
+  word_count_actual = 0;
+  start = clock();
+  wall_start = WallSeconds();
+  train_wall_start = wall_start;
+  RunTraining(0, iter);
+  PsBroadcast(&pc, PS_DONE, false);
+  if (debug_mode > 0) printf("\nWorker %d of %d: %lld words in %.1f s, %.0f words/sec\n", ps_worker, ps_worker_count,
+    word_count_actual, WallSeconds() - wall_start, word_count_actual / (WallSeconds() - wall_start));
+  if (ps_worker == 0) {
+    PsBroadcast(&pc, PS_WAIT, true);
+    printf("All %d workers: %lld words in %.1f s, %.0f words/sec\n", ps_worker_count, iter * train_words,
+      WallSeconds() - wall_start, iter * train_words / (WallSeconds() - wall_start));
+    if (output_file[0] != 0) {
+      syn0 = Alloc((long long)vocab_size * layer1_size * sizeof(real), "syn0");
+      ids = (int *)malloc(CHUNK_WORDS * sizeof(int));
+      for (a = 0; a < vocab_size; a += n) {
+        n = (vocab_size - a < CHUNK_WORDS) ? vocab_size - a : CHUNK_WORDS;
+        for (b = 0; b < n; b++) ids[b] = a + b;
+        PsPull(&pc, 0, ids, n, syn0 + a * layer1_size);
       }
+      free(ids);
+      SaveModel();
     }
-    // Save the K-means classes
-    for (a = 0; a < vocab_size; a++) fprintf(fo, "%s %d\n", vocab[a].word, cl[a]);
-    free(centcn);
-    free(cent);
-    free(cl);
+    PsBroadcast(&pc, PS_SHUTDOWN, true);
   }
-  fclose(fo);
+  PsClientClose(&pc);
+}
+#endif
+
+void TrainModel() {
+  PrepareVocab();
+  if (model_count == 0) return;
+  TrainModels();
 }
 
 int ArgPos(char *str, int argc, char **argv) {
@@ -1332,6 +3722,143 @@ int ArgPos(char *str, int argc, char **argv) {
   return -1;
 }
 
+// Reads the -models file.  Each line describes one model as
+//   <output file> [-pin <int>] [-pin-repeats <int>] [-pin-dims <list>] [-pin-data <file>]
+// with options not given taken from the command line.  Empty lines and lines
+// starting with '#' are ignored.
+void ReadModels() {
+  char line[1000], *argv[16];
+  int argc, i;
+  bool pin = optPin;
+  int pin_repeats = pinRepeats;
+  unsigned int pin_dims = pinDims;
+  char pin_data[MAX_STRING];
+  FILE *fin = fopen(models_file, "rb");
+  if (fin == NULL) {
+    printf("ERROR: models file not found: %s\n", models_file);
+    exit(1);
+  }
+  strcpy(pin_data, pinDataFile);
+  while (fgets(line, sizeof(line), fin) != NULL) {
+    argc = 0;
+    argv[argc] = strtok(line, " \t\r\n");
+    while ((argv[argc] != NULL) && (argc < 15)) argv[++argc] = strtok(NULL, " \t\r\n");
+    if ((argc == 0) || (argv[0][0] == '#')) continue;
+    strncpy(output_file, argv[0], MAX_STRING - 1);
+    optPin = pin;
+    pinRepeats = pin_repeats;
+    pinDims = pin_dims;
+    strcpy(pinDataFile, pin_data);
+    if ((i = ArgPos((char *)"-pin", argc, argv)) > 0) optPin = atoi(argv[i + 1]);
+    if ((i = ArgPos((char *)"-pin-repeats", argc, argv)) > 0) pinRepeats = atoi(argv[i + 1]);
+    if ((i = ArgPos((char *)"-pin-dims", argc, argv)) > 0) pinDims = ParsePinDims(argv[i + 1]);
+    if ((i = ArgPos((char *)"-pin-data", argc, argv)) > 0) strncpy(pinDataFile, argv[i + 1], MAX_STRING - 1);
+    AddModel();
+  }
+  fclose(fin);
+  if (model_count == 0) {
+    printf("ERROR: no models in %s\n", models_file);
+    exit(1);
+  }
+}
+
+// Runs every configuration of the -sweep file in turn.  Each line gives the
+// options that differ from the command line for one configuration:
+//   -output <file> [-size <int>] [-window <int>] [-sample <float>] [-negative <int>]
+//   [-hs <int>] [-cbow <int>] [-alpha <float>] [-iter <int>] [-pin <int>]
+//   [-pin-repeats <int>] [-pin-dims <list>] [-pin-data <file>]
+// The vocabulary, Huffman tree and unigram table are built once and shared;
+// each configuration uses all the training threads.  One line of statistics
+// per configuration is written to the -sweep-stats file.
+void RunSweep() {
+  char line[1000], *argv[32];
+  int argc, i, done = 0;
+  long long size0 = layer1_size, iter0 = iter;
+  int window0 = window, negative0 = negative, hs0 = hs, cbow0 = cbow;
+  real sample0 = sample, alpha0 = alpha, keep_sample = sample;
+  bool pin0 = optPin, alpha_given;
+  int pin_repeats0 = pinRepeats;
+  unsigned int pin_dims0 = pinDims;
+  char pin_data0[MAX_STRING];
+  clock_t cpu_start;
+  time_t wall_start;
+  FILE *fin, *fs;
+  strcpy(pin_data0, pinDataFile);
+  fin = fopen(sweep_file, "rb");
+  if (fin == NULL) {
+    printf("ERROR: sweep file not found: %s\n", sweep_file);
+    exit(1);
+  }
+  if (sweep_stats_file[0] == 0) sprintf(sweep_stats_file, "%s.stats", sweep_file);
+  fs = fopen(sweep_stats_file, "wb");
+  if (fs == NULL) {
+    printf("ERROR: can not write %s\n", sweep_stats_file);
+    exit(1);
+  }
+  fprintf(fs, "output\tsize\twindow\tsample\tnegative\ths\tcbow\talpha\titer\tpin\tpin_repeats\twords\tcpu_seconds\twall_seconds\n");
+  fflush(fs);
+  PrepareVocab();
+  while (fgets(line, sizeof(line), fin) != NULL) {
+    argc = 1;
+    argv[0] = (char *)"word2vec";
+    argv[argc] = strtok(line, " \t\r\n");
+    while ((argv[argc] != NULL) && (argc < 31)) argv[++argc] = strtok(NULL, " \t\r\n");
+    if ((argc == 1) || (argv[1][0] == '#')) continue;
+    layer1_size = size0;
+    window = window0;
+    sample = sample0;
+    negative = negative0;
+    hs = hs0;
+    cbow = cbow0;
+    alpha = alpha0;
+    iter = iter0;
+    optPin = pin0;
+    pinRepeats = pin_repeats0;
+    pinDims = pin_dims0;
+    strcpy(pinDataFile, pin_data0);
+    output_file[0] = 0;
+    if ((i = ArgPos((char *)"-output", argc, argv)) > 0) strncpy(output_file, argv[i + 1], MAX_STRING - 1);
+    if ((i = ArgPos((char *)"-size", argc, argv)) > 0) layer1_size = atoi(argv[i + 1]);
+    if ((i = ArgPos((char *)"-window", argc, argv)) > 0) window = atoi(argv[i + 1]);
+    if ((i = ArgPos((char *)"-sample", argc, argv)) > 0) sample = atof(argv[i + 1]);
+    if ((i = ArgPos((char *)"-negative", argc, argv)) > 0) negative = atoi(argv[i + 1]);
+    if ((i = ArgPos((char *)"-hs", argc, argv)) > 0) hs = atoi(argv[i + 1]);
+    if ((i = ArgPos((char *)"-iter", argc, argv)) > 0) iter = atoi(argv[i + 1]);
+    if ((i = ArgPos((char *)"-pin", argc, argv)) > 0) optPin = atoi(argv[i + 1]);
+    if ((i = ArgPos((char *)"-pin-repeats", argc, argv)) > 0) pinRepeats = atoi(argv[i + 1]);
+    if ((i = ArgPos((char *)"-pin-dims", argc, argv)) > 0) pinDims = ParsePinDims(argv[i + 1]);
+    if ((i = ArgPos((char *)"-pin-data", argc, argv)) > 0) strncpy(pinDataFile, argv[i + 1], MAX_STRING - 1);
+    alpha_given = (i = ArgPos((char *)"-alpha", argc, argv)) > 0;
+    if (alpha_given) alpha = atof(argv[i + 1]);
+    if ((i = ArgPos((char *)"-cbow", argc, argv)) > 0) {
+      cbow = atoi(argv[i + 1]);
+      if (!alpha_given) alpha = cbow ? 0.05 : 0.025;
+    }
+    if (output_file[0] == 0) {
+      printf("ERROR: sweep configuration without -output\n");
+      exit(1);
+    }
+    if (sample != keep_sample) {
+      InitSubsampling();
+      keep_sample = sample;
+    }
+    if (debug_mode > 0) printf("Sweep %d: %s\n", done + 1, output_file);
+    AddModel();
+    cpu_start = clock();
+    wall_start = time(NULL);
+    TrainModels();
+    fprintf(fs, "%s\t%lld\t%d\t%g\t%d\t%d\t%d\t%g\t%lld\t%d\t%d\t%lld\t%.2f\t%.0f\n", output_file, layer1_size,
+      window, sample, negative, hs, cbow, starting_alpha, iter, optPin, pinRepeats, word_count_actual,
+      (clock() - cpu_start) / (double)CLOCKS_PER_SEC, difftime(time(NULL), wall_start));
+    fflush(fs);
+    FreeModels();
+    done++;
+  }
+  fclose(fin);
+  fclose(fs);
+  if (debug_mode > 0) printf("Ran %d configurations; statistics are in %s\n", done, sweep_stats_file);
+}
+
 int main(int argc, char **argv) {
   int i;
   if (argc == 1) {
@@ -1339,7 +3866,8 @@ int main(int argc, char **argv) {
     printf("Options:\n");
     printf("Parameters for training:\n");
     printf("\t-train <file>\n");
-    printf("\t\tUse text data from <file> to train the model\n");
+    printf("\t\tUse text data from <file> to train the model; <file> may also be a directory, a glob pattern\n");
+    printf("\t\tor @<list>, a file naming one training file per line, in which case all the files are used\n");
     printf("\t-output <file>\n");
     printf("\t\tUse <file> to save the resulting word vectors / word clusters\n");
     printf("\t-size <int>\n");
@@ -1355,6 +3883,19 @@ int main(int argc, char **argv) {
     printf("\t\tNumber of negative examples; default is 5, common values are 3 - 10 (0 = not used)\n");
     printf("\t-threads <int>\n");
     printf("\t\tUse <int> threads (default 12)\n");
+    printf("\t-readers <int>\n");
+    printf("\t\tUse <int> threads to read the training data (default 1)\n");
+    printf("\t-reorder <int>\n");
+    printf("\t\tRenumber the vocabulary so that words occurring near each other in the first <int> words of the\n");
+    printf("\t\ttraining data get nearby rows; default is 0 (rows in frequency order)\n");
+    printf("\t-time-budget <float>\n");
+    printf("\t\tStop training after <float> seconds, adapting the learning rate schedule to the words that can\n");
+    printf("\t\tbe trained on in that time, and save the models as usual; default is 0 (no limit)\n");
+    printf("\t-hot-rows <int>\n");
+    printf("\t\tEach thread trains on private copies of the rows of the <int> most frequent words and adds its\n");
+    printf("\t\tchanges to the shared ones from time to time; default is 0 (off)\n");
+    printf("\t-hot-merge <int>\n");
+    printf("\t\tWith -hot-rows, merge each thread's changes every <int> words; default is 10000\n");
     printf("\t-iter <int>\n");
     printf("\t\tRun more training iterations (default 5)\n");
     printf("\t-min-count <int>\n");
@@ -1363,20 +3904,63 @@ int main(int argc, char **argv) {
     printf("\t\tSet the starting learning rate; default is 0.025 for skip-gram and 0.05 for CBOW\n");
     printf("\t-classes <int>\n");
     printf("\t\tOutput word classes rather than word vectors; default number of classes is 0 (vectors are written)\n");
+    printf("\t-kmeans-init <int>\n");
+    printf("\t\tWith -classes, start from k-means++ seeding (1, the default) or from round-robin classes (0)\n");
+    printf("\t-kmeans-iter <int>\n");
+    printf("\t\tMaximum number of k-means iterations; default is 10, or 100 batches with -kmeans-batch\n");
+    printf("\t-kmeans-tol <float>\n");
+    printf("\t\tStop k-means once no more than this fraction of the words change class; default is 0.001\n");
+    printf("\t-kmeans-batch <int>\n");
+    printf("\t\tUse mini-batch k-means with batches of <int> words; default is 0 (full k-means)\n");
     printf("\t-debug <int>\n");
     printf("\t\tSet the debug mode (default = 2 = more info during training)\n");
     printf("\t-binary <int>\n");
-    printf("\t\tSave the resulting vectors in binary moded; default is 0 (off)\n");
+    printf("\t\tSave the resulting vectors in binary moded; default is 0 (off); use 2 for the aligned format, which\n");
+    printf("\t\thas a header, a string table and a 64-byte aligned matrix that can be memory-mapped as is\n");
+    printf("\t-norms <int>\n");
+    printf("\t\tWith -binary 2, also store the norm of each vector; default is 1\n");
+    printf("\t-quantize <int>\n");
+    printf("\t\tWith -binary 2, store the vectors as 0 float32 (default), 1 float16 or 2 int8 with a scale per vector\n");
     printf("\t-save-vocab <file>\n");
     printf("\t\tThe vocabulary will be saved to <file>\n");
     printf("\t-read-vocab <file>\n");
     printf("\t\tThe vocabulary will be read from <file>, not constructed from the training data\n");
+    printf("\t-phrases <file>\n");
+    printf("\t\tJoin the phrases of the phrase table <file>, saved by word2phrase -save-phrases, as the training\n");
+    printf("\t\tdata is read, in place of training on the output of word2phrase\n");
+    printf("\t-vocab-cache <file>\n");
+    printf("\t\tMap the vocabulary, Huffman codes and sampling tables from the binary cache <file> if it matches\n");
+    printf("\t\tthe training data and parameters; otherwise build them and save them to <file>\n");
     printf("\t-cbow <int>\n");
     printf("\t\tUse the continuous bag of words model; default is 1 (use 0 for skip-gram model)\n");
     printf("\t-pin <int>\n");
     printf("\t\tPin certain words/features; default is 0 (use 1 to pin)\n");
     printf("\t-pin-repeats <int>\n");
     printf("\t\tNumber of times to repeat training examples involving pinned words (default = 1)\n");
+    printf("\t-pin-dims <list>\n");
+    printf("\t\tOnly pin the dimensions in <list>, e.g. 0-2 or 0,1,4; default is all of them\n");
+    printf("\t-pin-data <file>\n");
+    printf("\t\tAlso pin the has_wheels / is_dangerous values listed in the blackbox CSV <file>\n");
+    printf("\t-models <file>\n");
+    printf("\t\tTrain several models from a single pass over the data; each line of <file> is an output file\n");
+    printf("\t\toptionally followed by -pin, -pin-repeats, -pin-dims and -pin-data settings for that model\n");
+    printf("\t-branch-iter <int>\n");
+    printf("\t\tTrain one unpinned model for the first <int> iterations, then fork the -models from it for the\n");
+    printf("\t\tremaining ones; default is 0 (each model is trained from scratch)\n");
+    printf("\t-sweep <file>\n");
+    printf("\t\tTrain one model per line of <file>, building the vocabulary and sampling tables only once; each\n");
+    printf("\t\tline holds -output <file> and any of -size, -window, -sample, -negative, -hs, -cbow, -alpha, -iter\n");
+    printf("\t\tand the pinning options, overriding those given on the command line\n");
+    printf("\t-ps-serve <addr>\n");
+    printf("\t\tRun as a parameter server for distributed training, listening on <addr>, which is either\n");
+    printf("\t\t<host>:<port> or unix:<path>; use -ps-shard and -ps-shards to say which rows it holds\n");
+    printf("\t-ps-servers <addr,addr,...>\n");
+    printf("\t\tRun as a distributed training worker using these parameter servers, in shard order;\n");
+    printf("\t\tuse -ps-worker and -ps-workers to say which share of the data it trains on\n");
+    printf("\t-ps-shard <int>, -ps-shards <int>, -ps-worker <int>, -ps-workers <int>\n");
+    printf("\t\tIndex of this server / number of servers / index of this worker / number of workers\n");
+    printf("\t-sweep-stats <file>\n");
+    printf("\t\tWrite the statistics of the -sweep configurations to <file>; default is the sweep file + .stats\n");
     
     printf("\nExamples:\n");
     printf("./word2vec -train data.txt -output vec.txt -size 200 -window 5 -sample 1e-4 -negative 5 -hs 0 -binary 0 -cbow 1 -iter 3\n\n");
@@ -1385,12 +3969,28 @@ int main(int argc, char **argv) {
   output_file[0] = 0;
   save_vocab_file[0] = 0;
   read_vocab_file[0] = 0;
+  vocab_cache_file[0] = 0;
+  phrases_file[0] = 0;
+  models_file[0] = 0;
+  pinDataFile[0] = 0;
+  sweep_file[0] = 0;
+  sweep_stats_file[0] = 0;
+  ps_serve_addr[0] = 0;
+  ps_server_list[0] = 0;
   if ((i = ArgPos((char *)"-size", argc, argv)) > 0) layer1_size = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-train", argc, argv)) > 0) strcpy(train_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-save-vocab", argc, argv)) > 0) strcpy(save_vocab_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-read-vocab", argc, argv)) > 0) strcpy(read_vocab_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-vocab-cache", argc, argv)) > 0) strcpy(vocab_cache_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-phrases", argc, argv)) > 0) strcpy(phrases_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-binary", argc, argv)) > 0) binary = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-norms", argc, argv)) > 0) save_norms = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-quantize", argc, argv)) > 0) quantize = atoi(argv[i + 1]);
+  if ((quantize < MODEL_FLOAT32) || (quantize > MODEL_INT8)) {
+    printf("ERROR: -quantize must be 0, 1 or 2\n");
+    return 1;
+  }
   if ((i = ArgPos((char *)"-cbow", argc, argv)) > 0) cbow = atoi(argv[i + 1]);
   if (cbow) alpha = 0.05;
   if ((i = ArgPos((char *)"-alpha", argc, argv)) > 0) alpha = atof(argv[i + 1]);
@@ -1400,23 +4000,77 @@ int main(int argc, char **argv) {
   if ((i = ArgPos((char *)"-hs", argc, argv)) > 0) hs = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-negative", argc, argv)) > 0) negative = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_threads = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-readers", argc, argv)) > 0) num_readers = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-time-budget", argc, argv)) > 0) time_budget = atof(argv[i + 1]);
+  if ((i = ArgPos((char *)"-reorder", argc, argv)) > 0) reorder_sample = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-hot-rows", argc, argv)) > 0) hot_rows = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-hot-merge", argc, argv)) > 0) hot_merge = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-iter", argc, argv)) > 0) iter = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) min_count = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-classes", argc, argv)) > 0) classes = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-kmeans-init", argc, argv)) > 0) kmeans_init = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-kmeans-iter", argc, argv)) > 0) kmeans_iter = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-kmeans-tol", argc, argv)) > 0) kmeans_tol = atof(argv[i + 1]);
+  if ((i = ArgPos((char *)"-kmeans-batch", argc, argv)) > 0) kmeans_batch = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-pin", argc, argv)) > 0) optPin = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-pin-repeats", argc, argv)) > 0) pinRepeats = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-pin-dims", argc, argv)) > 0) pinDims = ParsePinDims(argv[i + 1]);
+  if ((i = ArgPos((char *)"-pin-data", argc, argv)) > 0) strcpy(pinDataFile, argv[i + 1]);
+  if ((i = ArgPos((char *)"-models", argc, argv)) > 0) strcpy(models_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-branch-iter", argc, argv)) > 0) branch_iter = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-sweep", argc, argv)) > 0) strcpy(sweep_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-sweep-stats", argc, argv)) > 0) strcpy(sweep_stats_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-ps-serve", argc, argv)) > 0) strcpy(ps_serve_addr, argv[i + 1]);
+  if ((i = ArgPos((char *)"-ps-servers", argc, argv)) > 0) strcpy(ps_server_list, argv[i + 1]);
+  if ((i = ArgPos((char *)"-ps-shard", argc, argv)) > 0) ps_shard = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-ps-shards", argc, argv)) > 0) ps_shard_count = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-ps-worker", argc, argv)) > 0) ps_worker = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-ps-workers", argc, argv)) > 0) ps_worker_count = atoi(argv[i + 1]);
+  if (ps_server_list[0] != 0) {
+    ps_shard_count = 1;
+    for (i = 0; ps_server_list[i]; i++) if (ps_server_list[i] == ',') ps_shard_count++;
+  }
+  if ((sweep_file[0] != 0) && (models_file[0] != 0)) {
+    printf("ERROR: -sweep and -models can not be used together\n");
+    return 1;
+  }
+  if (models_file[0] != 0) ReadModels();
+  else if ((output_file[0] != 0) && (sweep_file[0] == 0)) AddModel();
 
   printf("Training mode: %s", cbow ? "CBOW" : "SkipGram");
-  if (optPin) printf(" with pinned words; pin-repeats = %d", pinRepeats);
+  if (optPin && (model_count <= 1)) printf(" with pinned words; pin-repeats = %d", pinRepeats);
   printf("\n");
+  for (i = 0; (i < model_count) && (models_file[0] != 0); i++) {
+    printf("Model %d: %s", i + 1, models[i].output_file);
+    if (models[i].pin) printf(" with pinned words; pin-repeats = %d", models[i].pin_repeats);
+    printf("\n");
+  }
 
-  vocab = (struct vocab_word *)calloc(vocab_max_size, sizeof(struct vocab_word));
+  vocab_word_pos = (long long *)calloc(vocab_max_size, sizeof(long long));
+  vocab_count = (long long *)calloc(vocab_max_size, sizeof(long long));
   vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
   expTable = (real *)malloc((EXP_TABLE_SIZE + 1) * sizeof(real));
   for (i = 0; i < EXP_TABLE_SIZE; i++) {
     expTable[i] = exp((i / (real)EXP_TABLE_SIZE * 2 - 1) * MAX_EXP); // Precompute the exp() table
     expTable[i] = expTable[i] / (expTable[i] + 1);                   // Precompute f(x) = x / (x + 1)
   }
-  TrainModel();
+#ifndef _MSC_VER
+  if (ps_serve_addr[0] != 0) {
+    signal(SIGPIPE, SIG_IGN);
+    ServeRows();
+    return 0;
+  }
+  if (ps_server_list[0] != 0) {
+    signal(SIGPIPE, SIG_IGN);
+    TrainRemote();
+    return 0;
+  }
+#else
+  if ((ps_serve_addr[0] != 0) || (ps_server_list[0] != 0)) {
+    printf("ERROR: distributed training is not supported on Windows\n");
+    return 1;
+  }
+#endif
+  if (sweep_file[0] != 0) RunSweep(); else TrainModel();
   return 0;
 }